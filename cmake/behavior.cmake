@@ -27,6 +27,11 @@ if (STATIC_BUILD)
 	set(BUILD_SHARED_LIBS OFF)
 endif()
 
+# GUI application (belki-cli is always built)
+option(BUILD_GUI "Build the graphical application (needs a patched QtCharts)" TRUE)
+# microbenchmarks of compute kernels (belki_bench) and data generator (belki_synth)
+option(BUILD_BENCHMARKS "Build the benchmark suite" FALSE)
+
 # EXPERIMENTAL features
 option(EXPERIMENTAL "Enable experimental features" FALSE)
 function (export_experimental SOURCEFILE)
@@ -1,6 +1,7 @@
 ### fetch project dependencies
 set(DEP_INCLUDES "") # for target_include_directories
 set(DEP_LIBRARIES "") # for target_link_libraries
+set(DEP_GUI_LIBRARIES "") # for target_link_libraries, GUI application only
 
 if (APPLE)
 	include_directories("/usr/local/include" "/usr/local/opt/llvm/include")
@@ -47,7 +48,8 @@ else()
 endif()
 
 ## Qt
-set(QT_MODULES Concurrent Widgets Charts Svg)
+set(QT_MODULES Concurrent Gui)
+set(QT_GUI_MODULES Widgets Charts Svg)
 if (STATIC_BUILD AND ${CMAKE_SYSTEM_NAME} MATCHES "Windows")
 	# include plugins into static build on windows
 	# (we lack support for static on other platforms right now)
@@ -68,24 +70,30 @@ foreach(module ${QT_MODULES})
 	find_package(${QT_PREFIX}${module} CONFIG REQUIRED)
 	list(APPEND DEP_LIBRARIES ${QT_PREFIX}::${module})
 endforeach()
-foreach(plugin ${QT_PLUGINS})
-	list(APPEND DEP_LIBRARIES ${QT_PREFIX}::Q${plugin}Plugin)
-endforeach()
+if (BUILD_GUI)
+	foreach(module ${QT_GUI_MODULES})
+		find_package(${QT_PREFIX}${module} CONFIG REQUIRED)
+		list(APPEND DEP_GUI_LIBRARIES ${QT_PREFIX}::${module})
+	endforeach()
+	foreach(plugin ${QT_PLUGINS})
+		list(APPEND DEP_GUI_LIBRARIES ${QT_PREFIX}::Q${plugin}Plugin)
+	endforeach()
 
-# test for our patched QtCharts version; do this every time to reflect changes in Qt5Charts_DIR
-unset(HAVE_PATCHED_QTCHARTS CACHE)
-set(CMAKE_REQUIRED_LIBRARIES ${QT_PREFIX}::Charts)
-include(CheckCXXSourceCompiles)
-check_cxx_source_compiles("
-#include <QChart>
-#include <QLineSeries>
+	# test for our patched QtCharts version; do this every time to reflect changes in Qt5Charts_DIR
+	unset(HAVE_PATCHED_QTCHARTS CACHE)
+	set(CMAKE_REQUIRED_LIBRARIES ${QT_PREFIX}::Charts)
+	include(CheckCXXSourceCompiles)
+	check_cxx_source_compiles("
+	#include <QChart>
+	#include <QLineSeries>
 
-int main() {
-  auto f1 = &QtCharts::QChart::insertSeries;
-  auto f2 = &QtCharts::QLineSeries::setDynamicPointSize;
-}" HAVE_PATCHED_QTCHARTS)
-if (NOT HAVE_PATCHED_QTCHARTS)
-  message(FATAL_ERROR "A patched QtCharts is needed. Please specify path via Qt5Charts_DIR variable!")
+	int main() {
+	  auto f1 = &QtCharts::QChart::insertSeries;
+	  auto f2 = &QtCharts::QLineSeries::setDynamicPointSize;
+	}" HAVE_PATCHED_QTCHARTS)
+	if (NOT HAVE_PATCHED_QTCHARTS)
+	  message(FATAL_ERROR "A patched QtCharts is needed. Please specify path via Qt5Charts_DIR variable!")
+	endif()
 endif()
 
 # Find includes in corresponding build directories
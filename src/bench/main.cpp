@@ -0,0 +1,320 @@
+#include "dataset.h"
+#include "proteindb.h"
+#include "utils.h"
+#include "../storage/storage.h"
+#include "../compute/synthetic.h"
+#include "../compute/distmat.h"
+#include "../compute/hierarchy.h"
+#include "../compute/seriation.h"
+#include "../compute/annotations.h"
+#include "../compute/features.h"
+#include "../compute/dimred.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QBuffer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+/* expose the parsing and (de-)serialization stages without file handling */
+struct BenchStorage : Storage {
+	using Storage::Storage;
+	using Storage::readSource;
+	using Storage::writeProject;
+	using Storage::readProject;
+};
+
+struct Config {
+	std::vector<int> proteins, dimensions;
+	unsigned repeats = 3;
+	unsigned seed = 42;
+	float k = 1.f; // mean shift parameter
+	Features::Precision precision = Features::Precision::DOUBLE;
+	QStringList kernels; // empty means all
+};
+
+static const std::vector<std::pair<Distance, QString>> distanceNames = {
+    {Distance::EUCLIDEAN, "euclidean"},
+    {Distance::COSINE, "cosine"},
+    {Distance::CROSSCORREL, "crosscorrel"},
+    {Distance::PEARSON, "pearson"},
+    {Distance::EMD, "emd"},
+};
+
+class Bench {
+public:
+	explicit Bench(const Config &config) : config(config) {}
+
+	QJsonArray run();
+
+protected:
+	bool enabled(const QString &kernel) const {
+		return config.kernels.empty() || config.kernels.contains(kernel);
+	}
+
+	// time fun repeatedly and record minimum and median duration
+	template<typename F>
+	void measure(const QString &kernel, const QString &variant, F &&fun);
+
+	void runScale(int proteins, int dims);
+
+	const Config &config;
+	QJsonArray results;
+	QJsonObject scale; // current input size
+};
+
+template<typename F>
+void Bench::measure(const QString &kernel, const QString &variant, F &&fun)
+{
+	if (!enabled(kernel))
+		return;
+
+	std::cerr << "  " << kernel.toStdString();
+	if (!variant.isEmpty())
+		std::cerr << " (" << variant.toStdString() << ")";
+	std::cerr << std::flush;
+
+	std::vector<double> times;
+	for (unsigned i = 0; i < config.repeats; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		fun();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		times.push_back(elapsed.count());
+	}
+	QJsonArray all;
+	for (auto t : times)
+		all.append(t);
+	std::sort(times.begin(), times.end());
+	std::cerr << ": " << times.front() << " s" << std::endl;
+
+	auto entry = scale;
+	entry["kernel"] = kernel;
+	if (!variant.isEmpty())
+		entry["variant"] = variant;
+	entry["seconds"] = all;
+	entry["min"] = times.front();
+	entry["median"] = times[times.size() / 2];
+	results.append(entry);
+}
+
+QJsonArray Bench::run()
+{
+	for (auto proteins : config.proteins) {
+		for (auto dims : config.dimensions)
+			runScale(proteins, dims);
+	}
+	return results;
+}
+
+void Bench::runScale(int proteins, int dims)
+{
+	std::cerr << proteins << " proteins, " << dims << " dimensions" << std::endl;
+	scale = {{"proteins", proteins}, {"dimensions", dims}};
+
+	synthetic::Config gen;
+	gen.proteins = (size_t)proteins;
+	gen.dimensions = (size_t)dims;
+	gen.seed = config.seed;
+	auto profiles = synthetic::generate(gen);
+	QString simple, full;
+	QTextStream simpleOut(&simple), fullOut(&full);
+	synthetic::write_simple(simpleOut, profiles);
+	synthetic::write_long(fullOut, profiles);
+	simpleOut.flush();
+	fullOut.flush();
+
+	/* parsing, also provides the data for all following steps */
+	ProteinDB proteinDB;
+	BenchStorage storage(proteinDB);
+	QObject::connect(&storage, &Storage::message, [] (const GuiMessage &m) {
+		std::cerr << m.text.toStdString() << " " << m.informativeText.toStdString() << std::endl;
+	});
+	auto read = [&] (QString &text) {
+		return storage.readSource(QTextStream(&text, QIODevice::ReadOnly), {"Dist", false});
+	};
+	measure("Storage::readSource", "simple", [&] { read(simple); });
+	Features::Ptr input;
+	measure("Storage::readSource", "long", [&] { input = read(full); });
+	if (!input)
+		input = read(full);
+	if (!input)
+		return;
+
+	DatasetConfiguration conf;
+	conf.name = "synthetic";
+	conf.id = 1;
+	conf.precision = config.precision;
+	auto data = std::make_shared<Dataset>(proteinDB, conf);
+	data->spawn(std::move(input));
+	Features::Matrix features;
+	std::vector<ProteinId> protIds;
+	{
+		auto b = data->peek<Dataset::Base>();
+		features = b->features;
+		protIds = b->protIds;
+	}
+
+	measure("computeStats", {}, [&] { features::computeStats(features, true); });
+
+	SymmetricMatrix cosine;
+	for (auto &entry : distanceNames) {
+		auto m = entry.first;
+		measure("distmat::computeMatrix", entry.second, [&] {
+			auto result = distmat::computeMatrix(features, m);
+			if (m == Distance::COSINE)
+				cosine = std::move(result);
+		});
+	}
+
+	if (enabled("hierarchy::agglomerative")) {
+		if (cosine.empty())
+			cosine = distmat::computeMatrix(features, Distance::COSINE);
+		std::vector<std::pair<Linkage, QString>> linkages = {
+		    {Linkage::AVERAGE, "average"}, {Linkage::SINGLE, "single"},
+		    {Linkage::COMPLETE, "complete"}, {Linkage::WARD, "ward"}};
+		for (auto &entry : linkages) {
+			auto l = entry.first;
+			measure("hierarchy::agglomerative", "cosine, " + entry.second, [&] {
+				hierarchy::agglomerative(cosine, protIds, l);
+			});
+		}
+	}
+	if (enabled("hierarchy::optimalLeafOrder")) {
+		if (cosine.empty())
+			cosine = distmat::computeMatrix(features, Distance::COSINE);
+		auto h = hierarchy::agglomerative(cosine, protIds);
+		h->cuts = hierarchy::index(*h);
+		std::unordered_map<ProteinId, unsigned> index;
+		for (unsigned i = 0; i < protIds.size(); ++i)
+			index[protIds[i]] = i;
+		measure("hierarchy::optimalLeafOrder", "cosine, average", [&] {
+			hierarchy::optimalLeafOrder(*h, cosine, index);
+		});
+	}
+	cosine = {}; // free memory before mean shift
+
+	measure("seriation::spectral", {}, [&] { seriation::spectral(features); });
+
+	measure("annotations::Meanshift::run", QString("k=%1").arg((double)config.k), [&] {
+		annotations::Meanshift(features, {}).run(config.k); // L1, range unused
+	});
+
+	for (auto method : {"PCA", "tSNE"})
+		measure("dimred::compute", method, [&] { dimred::compute(method, features); });
+
+	/* (de-)serialization of a project holding the dataset */
+	QByteArray project;
+	std::vector<std::shared_ptr<const Dataset>> snapshot = {data};
+	measure("Storage::writeProject", {}, [&] {
+		QBuffer target(&project);
+		target.open(QIODevice::WriteOnly);
+		storage.writeProject(&target, snapshot);
+	});
+	if (enabled("Storage::readProject")) {
+		if (project.isEmpty()) {
+			QBuffer target(&project);
+			target.open(QIODevice::WriteOnly);
+			storage.writeProject(&target, snapshot);
+		}
+		QTemporaryDir dir;
+		auto filename = dir.filePath("bench.belki");
+		QFile f(filename);
+		if (!f.open(QIODevice::WriteOnly) || f.write(project) != project.size())
+			return;
+		f.close();
+		measure("Storage::readProject", {}, [&] {
+			ProteinDB target;
+			BenchStorage reader(target);
+			reader.readProject(filename);
+		});
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	qRegisterMetaType<GuiMessage>("GuiMessage");
+
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("belki_bench");
+	QCoreApplication::setApplicationVersion(PROJECT_VERSION);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Benchmark compute kernels on synthetic profile data. "
+	                                 "Results are written as JSON.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+	parser.addOptions({
+	    {{"o", "output"}, "Write results to <file> instead of standard output.", "file"},
+	    {"proteins", "Numbers of proteins to test (default: 1000,5000,20000).", "list"},
+	    {"dimensions", "Numbers of dimensions to test (default: 20,100,500).", "list"},
+	    {"repeats", "Repetitions per measurement (default: 3).", "n"},
+	    {"seed", "Seed of synthetic data (default: 42).", "n"},
+	    {"k", "Mean shift parameter (default: 1).", "k"},
+	    {"precision", "Storage precision: double, single or quantized.", "precision"},
+	    {"kernels", "Only run kernels in <list>, e.g. distmat::computeMatrix.", "list"},
+	});
+	parser.process(a);
+
+	auto toInts = [] (const QString &list, std::vector<int> fallback) {
+		if (list.isEmpty())
+			return fallback;
+		std::vector<int> ret;
+		for (auto &token : list.split(',')) {
+			auto v = token.toInt();
+			if (v > 0)
+				ret.push_back(v);
+		}
+		return ret;
+	};
+
+	Config config;
+	config.proteins = toInts(parser.value("proteins"), {1000, 5000, 20000});
+	config.dimensions = toInts(parser.value("dimensions"), {20, 100, 500});
+	if (parser.isSet("repeats"))
+		config.repeats = std::max(1u, parser.value("repeats").toUInt());
+	if (parser.isSet("seed"))
+		config.seed = parser.value("seed").toUInt();
+	if (parser.isSet("k"))
+		config.k = parser.value("k").toFloat();
+	if (parser.value("precision") == "single")
+		config.precision = Features::Precision::SINGLE;
+	if (parser.value("precision") == "quantized")
+		config.precision = Features::Precision::QUANTIZED;
+	if (parser.isSet("kernels"))
+		config.kernels = parser.value("kernels").split(',');
+
+	Bench bench(config);
+	auto results = bench.run();
+
+	QJsonObject top{
+		{"version", PROJECT_VERSION},
+		{"date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+		{"threads", QThread::idealThreadCount()},
+		{"repeats", (int)config.repeats},
+		{"seed", (int)config.seed},
+		{"precision", parser.value("precision").isEmpty() ? "double" : parser.value("precision")},
+		{"results", results},
+	};
+	auto json = QJsonDocument(top).toJson();
+
+	if (!parser.isSet("output")) {
+		std::cout << json.toStdString();
+		return 0;
+	}
+	QFile f(parser.value("output"));
+	if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+		std::cerr << "Could not write " << parser.value("output").toStdString() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,72 @@
+#include "../compute/synthetic.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("belki_synth");
+	QCoreApplication::setApplicationVersion(PROJECT_VERSION);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Generate synthetic protein profiles in a format Belki reads.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+	parser.addOptions({
+	    {{"o", "output"}, "Write to <file> instead of standard output.", "file"},
+	    {"format", "Output format: simple (matrix) or long (Protein/Pair/Dist/Score).", "format"},
+	    {"proteins", "Number of proteins (default: 1000).", "n"},
+	    {"dimensions", "Number of dimensions (default: 50).", "n"},
+	    {"clusters", "Number of distinct profile shapes (default: 12).", "n"},
+	    {"peaks", "Maximum number of peaks per profile shape (default: 3).", "n"},
+	    {"jitter", "Shift of peaks, relative to dimensions (default: 0.02).", "value"},
+	    {"noise", "Additive noise, relative to profile maximum (default: 0.02).", "value"},
+	    {"seed", "Random seed (default: 42).", "n"},
+	});
+	parser.process(a);
+
+	synthetic::Config config;
+	if (parser.isSet("proteins"))
+		config.proteins = parser.value("proteins").toULongLong();
+	if (parser.isSet("dimensions"))
+		config.dimensions = parser.value("dimensions").toULongLong();
+	if (parser.isSet("clusters"))
+		config.clusters = parser.value("clusters").toUInt();
+	if (parser.isSet("peaks"))
+		config.maxPeaks = parser.value("peaks").toUInt();
+	if (parser.isSet("jitter"))
+		config.jitter = parser.value("jitter").toDouble();
+	if (parser.isSet("noise"))
+		config.noise = parser.value("noise").toDouble();
+	if (parser.isSet("seed"))
+		config.seed = parser.value("seed").toUInt();
+
+	auto format = parser.value("format");
+	if (!format.isEmpty() && format != "simple" && format != "long") {
+		std::cerr << "Unknown format " << format.toStdString() << std::endl;
+		return 1;
+	}
+
+	QFile f;
+	bool success = parser.isSet("output")
+	        ? (f.setFileName(parser.value("output")), f.open(QIODevice::WriteOnly | QIODevice::Text))
+	        : f.open(stdout, QIODevice::WriteOnly | QIODevice::Text);
+	if (!success) {
+		std::cerr << "Could not open output: " << f.errorString().toStdString() << std::endl;
+		return 1;
+	}
+
+	auto profiles = synthetic::generate(config);
+	QTextStream out(&f);
+	if (format == "long")
+		synthetic::write_long(out, profiles);
+	else
+		synthetic::write_simple(out, profiles);
+	out.flush();
+	return out.status() == QTextStream::Ok ? 0 : 1;
+}
@@ -0,0 +1,250 @@
+#include "batchjob.h"
+#include "datahub.h"
+#include "dataset.h"
+#include "symmetricmatrix.h"
+#include "../compute/dimred.h"
+
+#include <QCommandLineParser>
+#include <QFile>
+#include <QTextStream>
+#include <QRegularExpression>
+#include <algorithm>
+#include <map>
+#include <iostream>
+
+void BatchJob::setupParser(QCommandLineParser &parser)
+{
+	parser.addOptions({
+	    {{"j", "job"}, "Read options from job <file>, one option per line.", "file"},
+	    {{"i", "input"}, "Dataset to import.", "file"},
+	    {{"o", "output"}, "Project file to write.", "file"},
+	    {"feature-column", "Column prefix of features in the input <name> (default: Dist).", "name"},
+	    {"precision", "Storage precision: double, single or quantized.", "precision"},
+	    {"bands", "Keep only feature bands in <list> (1-based, e.g. 1-5,8).", "list"},
+	    {"score-threshold", "Discard features with score above <value>.", "value"},
+	    {"normalize", "Normalize features to [0, 1]."},
+	    {"hierarchy", "Compute hierarchical clustering."},
+	    {"linkage", "Hierarchy linkage: average, single, complete or ward.", "linkage"},
+	    {"meanshift", "Compute mean shift clustering for each k in <list>.", "list"},
+	    {"metric", "Mean shift distance: l1, l2 or l2-normalized.", "metric"},
+	    {"no-prune", "Do not prune tiny mean shift clusters."},
+	    {"dimred", "Compute displays with methods in <list> (e.g. tSNE,MDS).", "list"},
+	    {"scratch-dir", "Map large matrices to files in <dir> (default: temp directory).", "dir"},
+	    {"map-threshold", "Map matrices larger than <size> MiB (default: 2048).", "size"},
+	});
+}
+
+QStringList BatchJob::readJobFile(const QString &filename, QString &error)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		error = QString("Could not open job file %1: %2").arg(filename, f.errorString());
+		return {};
+	}
+
+	QStringList ret;
+	QTextStream in(&f);
+	while (!in.atEnd()) {
+		auto line = in.readLine().trimmed();
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		auto parts = line.split(QRegularExpression("\\s+"));
+		ret << "--" + parts.takeFirst();
+		if (!parts.empty())
+			ret << parts.join(' ');
+	}
+	return ret;
+}
+
+static QStringList splitList(const QString &input)
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
+	return input.split(',', QString::SkipEmptyParts);
+#else
+	return input.split(',', Qt::SkipEmptyParts);
+#endif
+}
+
+/* parse a list like "1-5,8" into 0-based indices */
+static bool parseBands(const QString &input, std::vector<unsigned> &out)
+{
+	for (auto &token : splitList(input)) {
+		auto range = token.split('-');
+		bool ok1, ok2 = true;
+		unsigned first = range.front().toUInt(&ok1), last = first;
+		if (range.size() == 2)
+			last = range.back().toUInt(&ok2);
+		if (!ok1 || !ok2 || range.size() > 2 || first < 1 || last < first)
+			return false;
+		for (auto b = first; b <= last; ++b)
+			out.push_back(b - 1);
+	}
+	std::sort(out.begin(), out.end());
+	out.erase(std::unique(out.begin(), out.end()), out.end());
+	return true;
+}
+
+QString BatchJob::configure(const QCommandLineParser &parser)
+{
+	input = parser.value("input");
+	output = parser.value("output");
+	if (input.isEmpty() || output.isEmpty())
+		return "Both input and output need to be specified.";
+
+	if (parser.isSet("feature-column"))
+		featureColumn = parser.value("feature-column");
+
+	if (parser.isSet("precision")) {
+		std::map<QString, Features::Precision> names = {
+		    {"double", Features::Precision::DOUBLE},
+		    {"single", Features::Precision::SINGLE},
+		    {"quantized", Features::Precision::QUANTIZED}};
+		auto it = names.find(parser.value("precision").toLower());
+		if (it == names.end())
+			return "Unknown precision " + parser.value("precision");
+		precision = it->second;
+	}
+
+	if (parser.isSet("bands") && !parseBands(parser.value("bands"), bands))
+		return "Invalid band list " + parser.value("bands");
+
+	if (parser.isSet("score-threshold")) {
+		bool ok;
+		scoreThresh = parser.value("score-threshold").toDouble(&ok);
+		if (!ok || scoreThresh < 0.)
+			return "Invalid score threshold " + parser.value("score-threshold");
+	}
+
+	normalize = parser.isSet("normalize");
+	hierarchy = parser.isSet("hierarchy");
+
+	if (parser.isSet("linkage")) {
+		std::map<QString, Linkage> names = {
+		    {"average", Linkage::AVERAGE},
+		    {"single", Linkage::SINGLE},
+		    {"complete", Linkage::COMPLETE},
+		    {"ward", Linkage::WARD}};
+		auto it = names.find(parser.value("linkage").toLower());
+		if (it == names.end())
+			return "Unknown linkage " + parser.value("linkage");
+		linkage = it->second;
+	}
+	if (parser.isSet("metric")) {
+		std::map<QString, Annotations::Meta::Metric> names = {
+		    {"l1", Annotations::Meta::L1},
+		    {"l2", Annotations::Meta::L2},
+		    {"l2-normalized", Annotations::Meta::L2_NORMALIZED}};
+		auto it = names.find(parser.value("metric").toLower());
+		if (it == names.end())
+			return "Unknown metric " + parser.value("metric");
+		metric = it->second;
+	}
+	prune = !parser.isSet("no-prune");
+
+	for (auto &token : splitList(parser.value("meanshift"))) {
+		bool ok;
+		auto k = token.toFloat(&ok);
+		if (!ok || k <= 0.f)
+			return "Invalid mean shift parameter " + token;
+		meanshift.push_back(k);
+	}
+
+	for (auto &token : splitList(parser.value("dimred"))) {
+		// accept method names or ids, case-insensitive
+		auto &methods = dimred::availableMethods();
+		auto it = std::find_if(methods.begin(), methods.end(), [&token] (auto &m) {
+			return !m.name.compare(token, Qt::CaseInsensitive) ||
+			       !m.id.compare(token, Qt::CaseInsensitive);
+		});
+		if (it == methods.end())
+			return "Unknown dimensionality reduction method " + token;
+		displays << it->name;
+	}
+
+	scratchDir = parser.value("scratch-dir");
+	if (parser.isSet("map-threshold")) {
+		bool ok;
+		mappingThreshold = parser.value("map-threshold").toULongLong(&ok);
+		if (!ok)
+			return "Invalid mapping threshold " + parser.value("map-threshold");
+	}
+
+	return {};
+}
+
+bool BatchJob::run(DataHub &hub) const
+{
+	SymmetricMatrix::setScratch(scratchDir.toStdString(), (size_t)mappingThreshold << 20);
+
+	auto step = [] (const QString &text) {
+		std::cout << text.toStdString() << std::endl;
+	};
+
+	step("Importing " + input);
+	hub.importDataset(input, featureColumn, precision);
+	auto sets = hub.datasets();
+	if (sets.empty())
+		return false; // hub emitted a message
+	auto data = sets.rbegin()->second;
+
+	if (!bands.empty() || scoreThresh > 0. || normalize) {
+		step("Creating derived dataset");
+		auto &source = data->config();
+		DatasetConfiguration conf;
+		conf.name = source.name + " (batch)";
+		conf.parent = source.id;
+		conf.normalized = normalize || source.normalized;
+		conf.bands = bands;
+		conf.scoreThresh = scoreThresh;
+		conf.precision = precision;
+		auto dims = data->peek<Dataset::Base>()->dimensions.size();
+		if (!bands.empty() && bands.back() >= dims) {
+			std::cerr << "Band " << bands.back() + 1 << " out of range, dataset has "
+			          << dims << " bands." << std::endl;
+			return false;
+		}
+		if (scoreThresh > 0. && data->peek<Dataset::Base>()->scores.empty()) {
+			std::cerr << "Score threshold given, but dataset has no scores." << std::endl;
+			return false;
+		}
+		hub.spawn(data, conf);
+		data = hub.datasets().rbegin()->second;
+	}
+
+	if (hierarchy) {
+		step("Computing hierarchy");
+		data->computeHierarchy(linkage);
+	}
+
+	for (auto k : meanshift) {
+		step(QString("Computing mean shift, k=%1").arg((double)k, 0, 'f', 2));
+		Annotations::Meta desc{Annotations::Meta::MEANSHIFT};
+		desc.k = k;
+		desc.metric = metric;
+		desc.pruned = prune;
+		data->computeAnnotations(desc);
+
+		/* persist result, like the user would do to keep it in the project */
+		std::unique_ptr<::Annotations> result;
+		{
+			auto s = data->peek<Dataset::Structure>();
+			auto a = s->fetch(desc);
+			if (a)
+				result = std::make_unique<::Annotations>(*a);
+		}
+		if (result)
+			hub.proteins.addAnnotations(std::move(result), false, true);
+		else
+			std::cerr << "Mean shift did not result in any clusters." << std::endl;
+	}
+
+	for (auto &m : displays) {
+		if (data->peek<Dataset::Representations>()->displays.count(m))
+			continue;
+		step("Computing display " + m);
+		data->computeDisplay(m);
+	}
+
+	step("Writing " + output);
+	return hub.saveProject(output);
+}
@@ -0,0 +1,49 @@
+#ifndef BATCHJOB_H
+#define BATCHJOB_H
+
+#include "model.h"
+
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+class QCommandLineParser;
+class DataHub;
+
+/**
+ * @brief A batch computation on a single input dataset, performed without GUI
+ * The pipeline is: import → spawn (optional) → hierarchy → mean shift → displays → save.
+ * Parameters come from the command line or a job file. A job file holds one option per
+ * line, e.g. "bands 1-12" or "hierarchy"; lines starting with # are ignored.
+ */
+struct BatchJob {
+	static void setupParser(QCommandLineParser &parser);
+	// read job file and return its content as command line arguments
+	static QStringList readJobFile(const QString &filename, QString &error);
+
+	// fill from parsed options, returns an error message on failure
+	QString configure(const QCommandLineParser &parser);
+	// run the pipeline; results are persisted in the hub's project
+	bool run(DataHub &hub) const;
+
+	QString input, output;
+	QString featureColumn = "Dist";
+	Features::Precision precision = Features::Precision::DOUBLE;
+
+	// spawn, if any of these is set
+	std::vector<unsigned> bands; // 0-based, empty means all
+	double scoreThresh = 0.;
+	bool normalize = false;
+
+	bool hierarchy = false;
+	Linkage linkage = Linkage::AVERAGE;
+	std::vector<float> meanshift; // k values
+	Annotations::Meta::Metric metric = Annotations::Meta::L1;
+	bool prune = true;
+	QStringList displays; // dimensionality reduction methods (PCA is always computed)
+
+	QString scratchDir; // for large matrices, empty means temp directory
+	unsigned long long mappingThreshold = 2048; // MiB
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "batchjob.h"
+#include "datahub.h"
+#include "utils.h"
+
+// for registering meta types
+#include "model.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include <Eigen/Core>
+#include <iostream>
+
+static int fail(const QString &text)
+{
+	std::cerr << text.toStdString() << std::endl;
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	qRegisterMetaType<GuiMessage>("GuiMessage");
+
+	/* no event loop is run; computations happen synchronously on this thread */
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("belki-cli");
+	QCoreApplication::setApplicationVersion(PROJECT_VERSION);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Batch processing of Belki datasets without GUI.");
+	parser.addHelpOption();
+	parser.addVersionOption();
+	BatchJob::setupParser(parser);
+
+	auto args = a.arguments();
+	if (!parser.parse(args))
+		return fail(parser.errorText());
+	if (parser.isSet("help"))
+		parser.showHelp();
+	if (parser.isSet("version"))
+		parser.showVersion();
+
+	/* options from job file come first, so command line arguments override them */
+	if (parser.isSet("job")) {
+		QString error;
+		auto jobArgs = BatchJob::readJobFile(parser.value("job"), error);
+		if (!error.isEmpty())
+			return fail(error);
+		args = QStringList{args.front()} + jobArgs + args.mid(1);
+		if (!parser.parse(args))
+			return fail(parser.errorText());
+	}
+
+	/* parallelism comes from TBB (default concurrency); Eigen's OpenMP threads would
+	 * only pile up on top of it, as its products run inside TBB tasks */
+	Eigen::setNbThreads(1);
+
+	BatchJob job;
+	auto error = job.configure(parser);
+	if (!error.isEmpty())
+		return fail(error + "\n\n" + parser.helpText());
+
+	DataHub hub;
+	bool critical = false;
+	a.connect(&hub, &DataHub::message, [&critical] (const GuiMessage &m) {
+		std::cerr << m.text.toStdString();
+		if (!m.informativeText.isEmpty())
+			std::cerr << " " << m.informativeText.toStdString();
+		std::cerr << std::endl;
+		if (m.type == GuiMessage::CRITICAL)
+			critical = true;
+	});
+
+	bool success = job.run(hub);
+	return (success && !critical) ? 0 : 1;
+}
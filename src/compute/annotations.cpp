@@ -19,7 +19,7 @@ bool equal(const Annotations::Meta &a, const Annotations::Meta &b)
 		if (a.pruned != b.pruned) // currently shared by all types (MS, HIERCUT)
 			return false;
 		if (a.type == Annotations::Meta::MEANSHIFT) {
-			if (a.k != b.k)
+			if (a.k != b.k || a.metric != b.metric)
 				return false;
 		} else if (a.type == Annotations::Meta::HIERCUT) {
 			if (a.hierarchy != b.hierarchy)
@@ -80,12 +80,15 @@ void prune(Annotations &data)
 	});
 }
 
-Meanshift::Meanshift(const Features::Vec &input)
-    : fams(new seg_meanshift::FAMS({.pruneMinN = 0}))
+Meanshift::Meanshift(const Features::Matrix &input, const Features::Range &range)
+    : input(input), range(range)
 {
-	std::scoped_lock _(l);
-	fams->importPoints(input, true); // scales vectors
-	fams->selectStartPoints(0., 1); // perform for all features
+	using Metric = seg_meanshift::FAMS::Config::Metric;
+	for (auto metric : {Annotations::Meta::L1, Annotations::Meta::L2, Annotations::Meta::L2_NORMALIZED}) {
+		auto m = (metric == Annotations::Meta::L1 ? Metric::L1 : Metric::L2);
+		fams[metric] = std::make_unique<seg_meanshift::FAMS>(
+		                   seg_meanshift::FAMS::Config{.pruneMinN = 0, .metric = m});
+	}
 }
 
 Meanshift::~Meanshift()
@@ -94,31 +97,51 @@ Meanshift::~Meanshift()
 	std::scoped_lock _(l); // wait for cancel
 }
 
-std::optional<Meanshift::Result> Meanshift::run(float k)
+std::optional<Meanshift::Result> Meanshift::run(float k, Annotations::Meta::Metric metric,
+                                                bool speculative)
 {
-	fams->cancel();
-	std::scoped_lock _(l); // wait for any other threads to finish
+	std::unique_lock lock(l, std::defer_lock);
+	if (speculative) {
+		if (waiting || !lock.try_lock())
+			return {};
+	} else {
+		waiting++;
+		cancel();
+		lock.lock(); // wait for any other threads to finish
+		waiting--;
+	}
 
-	fams->resetState();
-	fams->config.k = k;
+	auto &f = *fams.at(metric);
+	if (f.getPoints().empty()) { // first use of this metric
+		// L1 and normalized L2 scale vectors to unit length, plain L2 maps the value range
+		f.importPoints(input, metric != Annotations::Meta::L2, input.scale, input.offset,
+		               range.min, range.max);
+		f.selectStartPoints(0., 1); // perform for all features
+	}
+
+	f.resetState();
+	if (speculative && waiting) // regular run came in, might have missed its cancel
+		return {};
+	f.config.k = k;
 
-	bool success = fams->prepareFAMS();
+	bool success = f.prepareFAMS();
 	if (!success) {	// cancelled
 		return {};
 	}
 
-	success = fams->finishFAMS();
+	success = f.finishFAMS();
 	if (!success) {	// cancelled
 		return {};
 	}
 
-	fams->pruneModes();
-	return {{fams->exportModes(), fams->getModePerPoint()}};
+	f.pruneModes();
+	return {{f.exportModes(), f.getModePerPoint()}};
 }
 
 void Meanshift::cancel()
 {
-	fams->cancel(); // note: asynchronous, non-blocking for us
+	for (auto &[_, f] : fams)
+		f->cancel(); // note: asynchronous, non-blocking for us
 }
 
 }
@@ -3,7 +3,9 @@
 
 #include "model.h"
 #include <memory>
+#include <map>
 #include <mutex>
+#include <atomic>
 
 namespace seg_meanshift {
 class FAMS;
@@ -21,19 +23,27 @@ class Meanshift {
 
 public:
 	struct Result {
-		Features::Vec modes;
+		cv::Mat1d modes; // actual values
 		std::vector<int> associations;
 	};
 
-	explicit Meanshift(const Features::Vec &input);
+	// range: of the actual feature values, used for metrics without normalization
+	Meanshift(const Features::Matrix &input, const Features::Range &range);
 	~Meanshift();
 
-	std::optional<Result> run(float k);
+	// speculative runs give way to (and do not cancel) regular runs
+	std::optional<Result> run(float k, Annotations::Meta::Metric metric = Annotations::Meta::L1,
+	                          bool speculative = false);
 	void cancel();
 
 protected:
-	std::unique_ptr<seg_meanshift::FAMS> fams;
+	// one per metric, each holds a copy of features after first use
+	std::map<Annotations::Meta::Metric, std::unique_ptr<seg_meanshift::FAMS>> fams;
+	Features::Matrix input; // shared with source
+	Features::Range range;
 	std::mutex l;
+	// regular runs waiting for the lock
+	std::atomic<int> waiting{0};
 };
 
 }
@@ -1,6 +1,7 @@
 #include "components.h"
 #include "dataset.h"
 #include "features.h"
+#include "jobregistry.h"
 
 #include <tbb/parallel_for.h>
 #include <cmath>
@@ -10,6 +11,8 @@ namespace components {
 std::pair<size_t, size_t> gauss_cover(double mean, double sigma, size_t range, double factor)
 {
 	auto allowance = factor*sigma;
+	if (range == 0 || mean + allowance < 0.)
+		return {1, 0}; // empty, left of the range
 	auto left = size_t(std::max(0., (mean - allowance))); // works with neg. values
 	auto right = size_t(std::min(range - 1., std::ceil(mean + allowance)));
 	return {left, right};
@@ -74,20 +77,27 @@ void Matcher::matchComponents(Components reference, unsigned topN, unsigned igno
 
 void Matcher::compute()
 {
-	auto distance = features::distfun(Distance::COSINE);
 	auto b = data->peek<Dataset::Base>();
 
 	/* precompute all distances in parallel */
-	std::vector<double> dists(b->features.size(), 0.);
+	std::vector<double> dists((size_t)b->features.rows, 0.);
 
 	if (config.refComponents.empty()) {
-		std::vector<double> r(b->features[config.reference].begin() + (int)config.range.first,
-		        b->features[config.reference].begin() + (int)config.range.second);
-		//for (size_t i = 0; i < dists.size(); ++i) {
-		tbb::parallel_for(size_t(0), dists.size(), [&] (size_t i) {
-			std::vector<double> f(b->features[i].begin() + (int)config.range.first,
-			                      b->features[i].begin() + (int)config.range.second);
-			dists[i] = distance(f, r);
+		auto offset = (int)config.range.first;
+		auto len = (size_t)((int)config.range.second - offset);
+		// note: cosine distance is invariant to the storage scale, but not to an offset
+		auto source = (b->features.offset == 0. ? b->features
+		               : features::convert(b->features, Features::Precision::SINGLE, {}));
+		features::visit(source, [&] (auto f) {
+			using T = typename decltype(f)::value_type;
+			auto distance = features::distfun<T>(Distance::COSINE);
+			auto r = f[(int)config.reference] + offset;
+			//for (size_t i = 0; i < dists.size(); ++i) {
+			JobRegistry::execute(Task::Priority::INTERACTIVE, [&] {
+				tbb::parallel_for(size_t(0), dists.size(), [&] (size_t i) {
+					dists[i] = distance(f[(int)i] + offset, r, len);
+				});
+			});
 		});
 	} else {
 		// TODO: component distances
@@ -12,6 +12,7 @@ class Dataset; // TODO: bad style, maybe Matcher should not be in compute/..
 
 namespace components {
 
+// inclusive [left, right] within [0, range); left > right if the pdf lies outside
 std::pair<size_t, size_t> gauss_cover(double mean, double sigma, size_t range, double factor=3.5);
 
 std::vector<double> generate_gauss(size_t range, double mean, double sigma, double scale=1.);
@@ -1,9 +1,9 @@
 #include "dimred.h"
+#include "features.h"
 #include <tapkee/tapkee.hpp> // includes Eigen
 #include <tapkee/callbacks/precomputed_callbacks.hpp>
 #include <tapkee/utils/logging.hpp>
 #include <opencv2/core.hpp>
-#include <opencv2/imgproc.hpp> // for EMD
 #include <tbb/parallel_for.h>
 
 #include <map>
@@ -44,12 +44,15 @@ const std::vector<dimred::Method> &availableMethods()
 	return ret;
 }
 
-QMap<QString, QVector<QPointF>> compute(QString m, const std::vector<std::vector<double>> &features)
+QMap<QString, QVector<QPointF>> compute(QString m, const Features::Matrix &input)
 {
-	if (features.empty() || features.front().size() < 3)
+	if (input.empty() || input.cols < 3)
 		return {};
 	std::cout << "Computing " << m.toStdString() << std::endl;
 
+	// tapkee only works on double, so reduced-precision data is expanded here
+	cv::Mat1d features = features::convert(input, Features::Precision::DOUBLE, {});
+
 	// setup some logging
 	tapkee::LoggingSingleton::instance().enable_info();
 	tapkee::LoggingSingleton::instance().enable_benchmark();
@@ -58,7 +61,7 @@ QMap<QString, QVector<QPointF>> compute(QString m, const std::vector<std::vector
 	ParametersSet p;
 	if (m.startsWith("PCA") || m.startsWith("kPCA") || m.startsWith("MDS")) {
 		p, method=(m == "PCA" ? PCA : (m.startsWith("kPCA") ? KernelPCA : MultidimensionalScaling));
-		p, target_dimension=std::min(size_t(3), features.front().size() - 1);
+		p, target_dimension=std::min(size_t(3), (size_t)features.cols - 1);
 	}
 	if (m.startsWith("tSNE")) {
 		p, method=tDistributedStochasticNeighborEmbedding, target_dimension=2;
@@ -71,32 +74,31 @@ QMap<QString, QVector<QPointF>> compute(QString m, const std::vector<std::vector
 		p, method=DiffusionMap, target_dimension=2;
 	}
 	auto parametrized = initialize().withParameters(p);
-	auto nFeat = features.size();
+	auto nFeat = (size_t)features.rows;
+	auto len = features.cols;
+
+	// EMD operates on sorted feature vectors
+	cv::Mat1d sorted;
+	if (m.endsWith("EMD"))
+		sorted = features::sorted_rows(input);
 
 	std::map<QString, std::function<double(size_t, size_t)>> distFun = {
 		{"L1", [&features] (size_t i, size_t j) {
-			return cv::norm(features[i], features[j], cv::NORM_L1);
+			return cv::norm(features.row((int)i), features.row((int)j), cv::NORM_L1);
 		}},
 		{"L2", [&features] (size_t i, size_t j) {
-			return cv::norm(features[i], features[j], cv::NORM_L2);
+			return cv::norm(features.row((int)i), features.row((int)j), cv::NORM_L2);
 		}},
 		{"NL2", [&features] (size_t i, size_t j) {
-			cv::Mat1d mi(features[i]), mj(features[j]);
-			mi /= cv::norm(mi);
-			mj /= cv::norm(mj);
-			return cv::norm(mi, mj); // TODO: use cv::NORM_L2SQR?
+			cv::Mat1d mi = features.row((int)i), mj = features.row((int)j);
+			return cv::norm(mi / cv::norm(mi), mj / cv::norm(mj)); // TODO: use cv::NORM_L2SQR?
 		}},
 		{"COS", [&features] (size_t i, size_t j) {
-			cv::Mat1d mi(features[i]), mj(features[j]);
+			cv::Mat1d mi = features.row((int)i), mj = features.row((int)j);
 			return mi.dot(mj) / (cv::norm(mi) * cv::norm(mj));
 		}},
-		{"EMD", [&features] (size_t i, size_t j) {
-			cv::Mat1f mi(features[i].size(), 1 + 1, 1.f); // weight + value
-			cv::Mat1f mj(features[j].size(), 1 + 1, 1.f); // weight + value
-			std::copy(features[i].cbegin(), features[i].cend(), mi.col(1).begin());
-			std::copy(features[j].cbegin(), features[j].cend(), mj.col(1).begin());
-			// use L1 here as we have scalar inputs anyway
-			return cv::EMD(mi, mj, cv::DIST_L1);
+		{"EMD", [&sorted,len] (size_t i, size_t j) {
+			return features::emd_sorted(sorted[(int)i], sorted[(int)j], (size_t)len);
 		}},
 	};
 
@@ -141,11 +143,10 @@ QMap<QString, QVector<QPointF>> compute(QString m, const std::vector<std::vector
 		output = parametrized.withKernel(k).embedUsing(indices);
 	// plain work on features
 	} else {
-		// setup feature matrix
-		IndexType nrows = features[0].size();
-		DenseMatrix featmat(nrows, nFeat);
-		for (size_t i = 0; i < nFeat; ++i)
-			featmat.col(i) = Eigen::Map<const DenseVector>(features[i].data(), nrows);
+		// setup feature matrix: our row-major layout is column-major from Eigen's view,
+		// so this is a single linear copy (tapkee insists on owning a DenseMatrix)
+		CV_Assert(features.isContinuous());
+		DenseMatrix featmat = Eigen::Map<const DenseMatrix>(features[0], len, nFeat);
 
 		output = parametrized.embedUsing(featmat);
 	}
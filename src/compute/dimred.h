@@ -1,6 +1,8 @@
 #ifndef DIMRED_H
 #define DIMRED_H
 
+#include "model.h"
+
 #include <QVector>
 #include <QMap>
 #include <QPointF>
@@ -14,7 +16,7 @@ namespace dimred {
 	};
 
 	QMap<QString, QVector<QPointF>>
-	compute(QString method, const std::vector<std::vector<double> > &features);
+	compute(QString method, const Features::Matrix &features);
 
 	const std::vector<Method> &availableMethods();
 }
@@ -1,62 +1,204 @@
 #include "distmat.h"
 #include "colors.h"
 
+#include <Eigen/Core>
 #include <tbb/parallel_for.h>
+#include <algorithm>
+#include <cmath>
 
 namespace distmat {
 
-cv::Mat1f computeMatrix(const std::vector<std::vector<double>> &features, Distance measure)
+using RowMatrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+/* decoded feature vectors, prepared once for the metric: unit length for
+ * COSINE/CROSSCORREL, additionally centred for PEARSON. Zero vectors stay zero. */
+template<Distance D>
+static RowMatrix prepare(const Features::Matrix &features)
+{
+	RowMatrix ret = features::visit(features, [&] (auto f) {
+		using T = typename decltype(f)::value_type;
+		using Map = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>,
+		                       0, Eigen::OuterStride<>>;
+		Map source(f[0], f.rows, f.cols, Eigen::OuterStride<>((Eigen::Index)f.step1()));
+		return RowMatrix((source.template cast<double>() * features.scale).array() + features.offset);
+	});
+
+	if constexpr (D == Distance::PEARSON) {
+		Eigen::VectorXd means = ret.rowwise().mean();
+		ret.colwise() -= means;
+	}
+	if constexpr (D != Distance::EUCLIDEAN) {
+		Eigen::VectorXd norms = ret.rowwise().norm();
+		for (Eigen::Index i = 0; i < ret.rows(); ++i) {
+			if (norms[i] > 0.)
+				ret.row(i) /= norms[i];
+		}
+	}
+	return ret;
+}
+
+/* distance from dot product of prepared vectors */
+template<Distance D>
+static float finish(double dot, double sqnormA, double sqnormB)
+{
+	if constexpr (D == Distance::EUCLIDEAN) {
+		return (float)std::sqrt(std::max(0., sqnormA + sqnormB - 2.*dot));
+	} else if constexpr (D == Distance::COSINE) {
+		return (float)std::acos(std::clamp(dot, -1., 1.));
+	} else { // CROSSCORREL, PEARSON
+		return (float)dot;
+	}
+}
+
+/* all measures that boil down to dot products, computed as a matrix multiply */
+template<Distance D>
+static SymmetricMatrix computeBlocked(const Features::Matrix &features)
+{
+	auto input = prepare<D>(features);
+	auto n = input.rows();
+	Eigen::VectorXd sqnorms;
+	if constexpr (D == Distance::EUCLIDEAN)
+		sqnorms = input.rowwise().squaredNorm();
+	SymmetricMatrix ret((size_t)n);
+
+	/* fill upper triangle in tiles of band × band, one product per task; Eigen itself
+	   is kept single-threaded at startup, so all parallelism stays within our arenas */
+	const Eigen::Index band = 256;
+	tbb::parallel_for(Eigen::Index(0), n, band, [&] (Eigen::Index y0) {
+		auto rows = std::min(band, n - y0);
+		tbb::parallel_for(y0, n, band, [&] (Eigen::Index x0) {
+			auto cols = std::min(band, n - x0);
+			RowMatrix dots = input.middleRows(y0, rows) * input.middleRows(x0, cols).transpose();
+			for (Eigen::Index i = 0; i < rows; ++i) {
+				auto y = y0 + i;
+				auto out = ret.row((size_t)y) - y; // index by column
+				for (auto x = std::max(y, x0); x < x0 + cols; ++x) {
+					if constexpr (D == Distance::EUCLIDEAN)
+						out[x] = finish<D>(dots(i, x - x0), sqnorms[y], sqnorms[x]);
+					else
+						out[x] = finish<D>(dots(i, x - x0), 1., 1.);
+				}
+				if constexpr (D == Distance::EUCLIDEAN) {
+					if (x0 == y0)
+						out[y] = 0.f; // avoid cancellation residue
+				}
+			}
+		});
+	});
+	return ret;
+}
+
+/* EMD, evaluated pair by pair on rows that are sorted once up front */
+static SymmetricMatrix computeEMD(const Features::Matrix &features)
+{
+	auto sorted = features::sorted_rows(features);
+	auto sidelen = sorted.rows;
+	auto len = (size_t)sorted.cols;
+	SymmetricMatrix ret((size_t)sidelen);
+	tbb::parallel_for(0, sidelen, [&] (int y) {
+		auto out = ret.row((size_t)y) - y; // index by column
+		for (int x = y; x < sidelen; ++x)
+			out[x] = (float)features::emd_sorted(sorted[y], sorted[x], len);
+	});
+	return ret;
+}
+
+SymmetricMatrix computeMatrix(const Features::Matrix &features, Distance measure)
 {
-	auto sidelen = features.size();
-	cv::Mat1f ret(sidelen, sidelen);
-
-	/* amass all the combinations we need for filling a symmetric matrix */
-	std::vector<cv::Point2i> coords; // use int for matrix() indexing later on
-	for (int y = 0; y < (int)sidelen; ++y) {
-		for (int x = 0; x <= y; ++x)
-			coords.push_back({x, y});
+	if (features.empty())
+		return {};
+
+	switch (measure) {
+	case Distance::EUCLIDEAN: return computeBlocked<Distance::EUCLIDEAN>(features);
+	case Distance::COSINE: return computeBlocked<Distance::COSINE>(features);
+	case Distance::CROSSCORREL: return computeBlocked<Distance::CROSSCORREL>(features);
+	case Distance::PEARSON: return computeBlocked<Distance::PEARSON>(features);
+	default: return computeEMD(features);
 	}
+}
+
+Neighbors computeNeighbors(const Features::Matrix &features, size_t k)
+{
+	Neighbors ret;
+	if (features.rows < 2)
+		return ret;
+
+	auto input = prepare<Distance::COSINE>(features);
+	auto n = input.rows();
+	ret.k = std::min(k, (size_t)n - 1);
+	ret.index.resize((size_t)n * ret.k);
+	ret.distance.resize((size_t)n * ret.k);
 
-	/* get the work done in parallel */
-	auto dist = features::distfun(measure);
-	tbb::parallel_for((size_t)0, coords.size(), [&] (size_t i) {
-		auto c = coords[i];
-		const auto &a = features[(size_t)c.x], &b = features[(size_t)c.y];
-		ret(c) = ret(c.x, c.y) = (float)dist(a, b);
+	/* one band of rows against all rows per task, so we never hold the full matrix;
+	   band size keeps each product at about 8 MiB */
+	const Eigen::Index band = std::max(Eigen::Index(16), Eigen::Index(1 << 20) / n);
+	tbb::parallel_for(Eigen::Index(0), n, band, [&] (Eigen::Index y0) {
+		auto rows = std::min(band, n - y0);
+		RowMatrix dots = input.middleRows(y0, rows) * input.transpose();
+		std::vector<std::pair<double, unsigned>> candidates;
+		candidates.reserve((size_t)n - 1);
+		for (Eigen::Index i = 0; i < rows; ++i) {
+			auto y = y0 + i;
+			candidates.clear();
+			for (Eigen::Index x = 0; x < n; ++x) {
+				if (x != y)
+					candidates.push_back({-dots(i, x), (unsigned)x}); // most similar first
+			}
+			std::partial_sort(candidates.begin(), candidates.begin() + ret.k, candidates.end());
+			auto offset = (size_t)y * ret.k;
+			for (size_t j = 0; j < ret.k; ++j) {
+				ret.index[offset + j] = candidates[j].second;
+				ret.distance[offset + j] = finish<Distance::COSINE>(-candidates[j].first, 1., 1.);
+			}
+		}
 	});
 	return ret;
 }
 
-QPixmap computeImage(const cv::Mat1f &matrix, Distance measure, const TranslateFun &translate)
+// largest side length of generated images
+static const size_t maxImageSide = 8192;
+
+QPixmap computeImage(const SymmetricMatrix &matrix, Distance measure, const TranslateFun &translate)
 {
+	if (matrix.empty())
+		return {};
+
 	/* determine shift & scale to fit into uchar */
-	double minVal, maxVal;
+	float minVal, maxVal;
 	switch (measure) {
 	case Distance::PEARSON:
-		minVal = -1.;
-		maxVal = 1.;
+		minVal = -1.f;
+		maxVal = 1.f;
 		break;
 	case Distance::CROSSCORREL:
-		minVal = 0.;
-		maxVal = 1.;
+		minVal = 0.f;
+		maxVal = 1.f;
 		break;
 	default:
-		cv::minMaxLoc(matrix, &minVal, &maxVal);
+		auto [minIt, maxIt] = std::minmax_element(matrix.begin(), matrix.end());
+		minVal = *minIt;
+		maxVal = *maxIt;
 	}
 
-	/* convert to Mat1b and reorder at the same time */
-	float scale = 255./(maxVal - minVal);
-	cv::Mat1b matrixB(matrix.rows, matrix.cols);
-	tbb::parallel_for(0, matrix.rows, [&] (int y) {
-		for (int x = 0; x <= y; ++x)
-			matrixB(y, x) = matrixB(x, y)
-			        = (uchar)((matrix(translate(y, x)) - (float)minVal)*scale);
+	/* convert to Mat1b and reorder at the same time;
+	   sample down large matrices, as QImage needs its byte size to fit into int */
+	float scale = 255.f/(maxVal - minVal);
+	auto n = matrix.size();
+	auto sidelen = std::min(n, maxImageSide);
+	auto source = [n,sidelen] (size_t pixel) { return (int)(pixel * n / sidelen); };
+	cv::Mat1b matrixB((int)sidelen, (int)sidelen);
+	tbb::parallel_for(size_t(0), sidelen, [&] (size_t y) {
+		for (size_t x = 0; x <= y; ++x) {
+			auto p = translate(source(y), source(x));
+			matrixB((int)y, (int)x) = matrixB((int)x, (int)y)
+			        = (uchar)((matrix((size_t)p.y, (size_t)p.x) - minVal)*scale);
+		}
 	});
 
 	return Colormap::pixmap(Colormap::magma.apply(matrixB));
 }
 
-QPixmap computeImage(const cv::Mat1f &matrix, Distance measure)
+QPixmap computeImage(const SymmetricMatrix &matrix, Distance measure)
 {
 	return computeImage(matrix, measure, [] (int y, int x) { return cv::Point(x, y); });
 }
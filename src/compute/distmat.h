@@ -7,14 +7,23 @@
 #include <opencv2/core/core.hpp>
 #include <functional>
 #include <map>
+#include <vector>
 
 namespace distmat
 {
 	using TranslateFun = std::function<cv::Point(int,int)>;
 
-	cv::Mat1f computeMatrix(const std::vector<std::vector<double>> &features, Distance measure);
-	QPixmap computeImage(const cv::Mat1f &matrix, Distance measure);
-	QPixmap computeImage(const cv::Mat1f &matrix, Distance measure, const TranslateFun &translate);
+	/* k nearest neighbors of each row by cosine distance, row by row, nearest first */
+	struct Neighbors {
+		size_t k = 0;
+		std::vector<unsigned> index;
+		std::vector<float> distance;
+	};
+
+	SymmetricMatrix computeMatrix(const Features::Matrix &features, Distance measure);
+	Neighbors computeNeighbors(const Features::Matrix &features, size_t k);
+	QPixmap computeImage(const SymmetricMatrix &matrix, Distance measure);
+	QPixmap computeImage(const SymmetricMatrix &matrix, Distance measure, const TranslateFun &translate);
 }
 
 #endif // DISTMAT_H
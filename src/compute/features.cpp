@@ -2,23 +2,64 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp> // for calchist
 #include <tbb/parallel_for.h>
-#include <tbb/parallel_for_each.h>
 #include <tbb/parallel_reduce.h>
+#include <numeric>
 
 namespace features {
 
-Features::Range range_of(const vec &source, float fraction)
+Features::Precision precision_of(const matrix &source)
+{
+	switch (source.depth()) {
+	case CV_32F: return Features::Precision::SINGLE;
+	case CV_16U: return Features::Precision::QUANTIZED;
+	default: return Features::Precision::DOUBLE;
+	}
+}
+
+matrix convert(const matrix &source, Features::Precision precision, const Features::Range &range)
+{
+	int depth = CV_64F;
+	double scale = 1., offset = 0.;
+	if (precision == Features::Precision::SINGLE) {
+		depth = CV_32F;
+	} else if (precision == Features::Precision::QUANTIZED) {
+		/* the offset is a whole multiple of scale below range.min (or 0), so that
+		 * 0, as set for erased features, stays exactly representable */
+		depth = CV_16U;
+		auto lower = std::min(range.min, 0.);
+		if (range.max > lower) {
+			scale = (range.max - lower) / 65534.;
+			offset = std::floor(lower / scale) * scale;
+		}
+	}
+	if (source.empty() || (source.depth() == depth && source.scale == scale
+	                       && source.offset == offset))
+		return source;
+
+	matrix ret(cv::Mat(), scale, offset);
+	source.convertTo(ret, depth, source.scale / scale, (source.offset - offset) / scale);
+	return ret;
+}
+
+cv::Mat1d row_of(const matrix &source, int row)
+{
+	if (source.depth() == CV_64F && source.scale == 1. && source.offset == 0.)
+		return source.row(row);
+
+	cv::Mat1d ret;
+	source.row(row).convertTo(ret, CV_64F, source.scale, source.offset);
+	return ret;
+}
+
+Features::Range range_of(const matrix &source, float fraction)
 {
 	if (source.empty())
 		return {};
 
-	Features::Range ret{source[0][0], source[0][0]};
-	for (auto in : source) {
-		double mi, ma;
-		cv::minMaxLoc(in, &mi, &ma);
-		ret.min = std::min(ret.min, mi);
-		ret.max = std::max(ret.max, ma);
-	}
+	Features::Range ret;
+	cv::minMaxLoc(source, &ret.min, &ret.max);
+	ret.min = ret.min * source.scale + source.offset;
+	ret.max = ret.max * source.scale + source.offset;
 	if (fraction == 0.f || fraction == 1.0f)
 		return ret;
 
@@ -27,20 +68,14 @@ Features::Range range_of(const vec &source, float fraction)
 	int bins = 100;
 	auto range = { (float)ret.min, (float)(1.0001*ret.max)};
 
-	/* while calcHist() expects InputArrayOfArrays, it does not do what we want
-	   when given several arrays at once. So we need a loop w/ accumulate flag */
-	for (auto &s : source) {
-		/* OpenCV does not support computing histograms on double. Doh! */
-		std::vector<cv::Mat> temp(1);
-		cv::Mat1d(s).convertTo(temp.front(), cv::DataType<float>::type);
-
-		cv::calcHist(temp, {0}, cv::Mat(), hist, {bins}, range, true); // acc.
-	}
+	/* OpenCV does not support computing histograms on double. Doh! */
+	std::vector<cv::Mat> temp(1);
+	source.convertTo(temp.front(), cv::DataType<float>::type, source.scale, source.offset);
+	cv::calcHist(temp, {0}, cv::Mat(), hist, {bins}, range);
 
 	/* we defensively choose bin borders as new range approx. */
 	double binsize = (ret.max - ret.min)/(double)bins;
-	unsigned needed = (unsigned)std::ceil(
-	            (float)(source.size()*source[0].size())*(1.f - fraction));
+	unsigned needed = (unsigned)std::ceil((float)source.total()*(1.f - fraction));
 
 	auto findFractionBin = [&] (bool reverse = false) {
 		// start from first (or last) bin
@@ -80,92 +115,123 @@ Features::Range log_valid(const Features::Range &range)
 	return {std::max(range.min, lb), std::max(range.max, lb)};
 }
 
-void normalize(vec &feats, const Features::Range &inputRange)
+void normalize(matrix &feats, const Features::Range &inputRange)
 {
 	double scale = 1. / (inputRange.max - inputRange.min);
-	tbb::parallel_for_each(feats, [&] (std::vector<double> &v) {
-		std::for_each(v.begin(), v.end(), [min=inputRange.min, scale] (double &e) {
-			e = std::max(e - min, 0.) * scale;
+	// quantized data keeps its full resolution on the new [0, 1] range
+	double target = (feats.depth() == CV_16U ? 1./65535. : 1.);
+	visit(feats, [&] (auto f) {
+		using T = typename decltype(f)::value_type;
+		auto factor = scale / target;
+		tbb::parallel_for(0, f.rows, [&] (int i) {
+			std::for_each(f[i], f[i] + f.cols, [&] (T &e) {
+				e = cv::saturate_cast<T>(std::max(e * feats.scale + feats.offset - inputRange.min, 0.)
+				                         * factor);
+			});
 		});
 	});
+	feats.scale = target;
+	feats.offset = 0.;
 }
 
-unsigned cutoff_effect(const vec &source, double threshold)
+unsigned cutoff_effect(const matrix &source, double threshold)
 {
-	auto check = [&] (size_t index) {
-		const auto &v = source[index];
-		return std::any_of(v.begin(), v.end(), [&] (double value) {
-			return value > threshold;
-		});
-	};
-	auto range = tbb::blocked_range<size_t>(size_t(0), source.size());
-	return tbb::parallel_reduce(range, unsigned(0), [&] (auto r, unsigned init) {
-		for (auto it = r.begin(); it != r.end(); ++it)
-			init += check(it);
-		return init;
-	}, std::plus<unsigned>());
+	auto limit = (threshold - source.offset) / source.scale; // compare in stored units
+	return visit(source, [&] (auto s) {
+		auto check = [&] (size_t index) {
+			auto v = s[(int)index];
+			return std::any_of(v, v + s.cols, [limit] (double value) {
+				return value > limit;
+			});
+		};
+		auto range = tbb::blocked_range<size_t>(size_t(0), (size_t)s.rows);
+		return tbb::parallel_reduce(range, unsigned(0), [&] (auto r, unsigned init) {
+			for (auto it = r.begin(); it != r.end(); ++it)
+				init += check(it);
+			return init;
+		}, std::plus<unsigned>());
+	});
 }
 
-vec with_cutoff(const vec &feats, const vec &scores, double threshold)
+matrix with_cutoff(const matrix &feats, const matrix &scores, double threshold)
 {
-	vec ret(feats.size());
-	tbb::parallel_for(size_t(0), feats.size(), [&] (size_t p) {
-		auto &source = feats[p];
-		auto &target = ret[p];
-		auto &score = scores[p];
-		target.resize(source.size());
-		for (size_t i = 0; i < source.size(); ++i)
-			target[i] = (score[i] <= threshold) * source[i];
+	matrix ret(cv::Mat(feats.size(), feats.type()), feats.scale, feats.offset);
+	auto limit = (threshold - scores.offset) / scores.scale;
+	visit(ret, [&] (auto out) {
+		using T = typename decltype(out)::value_type;
+		cv::Mat_<T> in(feats);
+		auto zero = cv::saturate_cast<T>(-feats.offset / feats.scale);
+		visit(scores, [&] (auto sc) {
+			tbb::parallel_for(0, in.rows, [&] (int p) {
+				auto source = in[p];
+				auto target = out[p];
+				auto score = sc[p];
+				for (int i = 0; i < in.cols; ++i)
+					target[i] = (score[i] <= limit ? source[i] : zero);
+			});
+		});
 	});
 	return ret;
 }
 
-void apply_cutoff(vec &feats, vec &scores, double threshold)
+void apply_cutoff(matrix &feats, matrix &scores, double threshold)
 {
-	tbb::parallel_for(size_t(0), feats.size(), [&] (size_t p) {
-		auto &feat = feats[p];
-		auto &score = scores[p];
-		for (size_t i = 0; i < feat.size(); ++i) {
-			if (score[i] > threshold) {
-				feat[i] = 0.;
-				score[i] = threshold; // normalize to new limit
-			}
-		}
+	auto limit = (threshold - scores.offset) / scores.scale;
+	visit(feats, [&] (auto fs) {
+		using T = typename decltype(fs)::value_type;
+		auto zero = cv::saturate_cast<T>(-feats.offset / feats.scale);
+		visit(scores, [&] (auto sc) {
+			using S = typename decltype(sc)::value_type;
+			tbb::parallel_for(0, fs.rows, [&] (int p) {
+				auto feat = fs[p];
+				auto score = sc[p];
+				for (int i = 0; i < fs.cols; ++i) {
+					if (score[i] > limit) {
+						feat[i] = zero;
+						score[i] = cv::saturate_cast<S>(limit); // normalize to new limit
+					}
+				}
+			});
+		});
 	});
 }
 
-std::vector<QVector<QPointF>> pointify(const vec &source)
+std::vector<QVector<QPointF>> pointify(const matrix &source)
 {
-	std::vector<QVector<QPointF>> ret;
-	for (auto f : source) {
-		QVector<QPointF> points(f.size());
-		for (size_t i = 0; i < f.size(); ++i)
-			points[i] = {(qreal)i, f[i]};
-		ret.push_back(std::move(points));
-	}
+	std::vector<QVector<QPointF>> ret((size_t)source.rows);
+	visit(source, [&] (auto s) {
+		tbb::parallel_for(0, s.rows, [&] (int p) {
+			auto f = s[p];
+			QVector<QPointF> points(s.cols);
+			for (int i = 0; i < s.cols; ++i)
+				points[i] = {(qreal)i, f[i] * source.scale + source.offset};
+			ret[(size_t)p] = std::move(points);
+		});
+	});
 	return ret;
 }
 
-QVector<QPointF> scatter(const vec &x, size_t xi, const vec &y, size_t yi)
+QVector<QPointF> scatter(const matrix &x, size_t xi, const matrix &y, size_t yi)
 {
-	QVector<QPointF> ret(x.size());
-	for (size_t i = 0; i < x.size(); ++i)
-		ret[i] = {x[i][xi], y[i][yi]};
+	QVector<QPointF> ret(x.rows);
+	visit(x, [&] (auto xs) {
+		for (int i = 0; i < xs.rows; ++i)
+			ret[i].setX(xs(i, (int)xi) * x.scale + x.offset);
+	});
+	visit(y, [&] (auto ys) {
+		for (int i = 0; i < ys.rows; ++i)
+			ret[i].setY(ys(i, (int)yi) * y.scale + y.offset);
+	});
 	return ret;
 }
 
-template<>
-double distance<Distance::EUCLIDEAN>(const std::vector<double> &a, const std::vector<double> &b)
-{
-	return cv::norm(a, b, cv::NORM_L2);
-}
-
-template<>
-double distance<Distance::CROSSCORREL>(const std::vector<double> &a, const std::vector<double> &b)
+/* normalized cross-correlation of a - ma and b - mb, centred on the fly */
+template<typename T>
+static double correlate(const T *a, const T *b, size_t len, double ma, double mb)
 {
 	double corr1 = 0., corr2 = 0., crosscorr = 0.;
-	for (unsigned i = 0; i < a.size(); ++i) {
-		auto v1 = a[i], v2 = b[i];
+	for (size_t i = 0; i < len; ++i) {
+		double v1 = a[i] - ma, v2 = b[i] - mb;
 		corr1 += v1*v1;
 		corr2 += v2*v2;
 		crosscorr += v1*v2;
@@ -175,52 +241,104 @@ double distance<Distance::CROSSCORREL>(const std::vector<double> &a, const std::
 	return crosscorr / std::sqrt(corr1*corr2);
 }
 
-template<>
-double distance<Distance::COSINE>(const std::vector<double> &a, const std::vector<double> &b)
+template<Distance D, typename T>
+double distance(const T *a, const T *b, size_t len)
 {
-	return std::acos(distance<Distance::CROSSCORREL>(a, b));
+	if constexpr (D == Distance::EUCLIDEAN) {
+		double ret = 0.;
+		for (size_t i = 0; i < len; ++i) {
+			double d = (double)a[i] - (double)b[i];
+			ret += d*d;
+		}
+		return std::sqrt(ret);
+	} else if constexpr (D == Distance::CROSSCORREL) {
+		return correlate(a, b, len, 0., 0.);
+	} else if constexpr (D == Distance::COSINE) {
+		return std::acos(distance<Distance::CROSSCORREL>(a, b, len));
+	} else if constexpr (D == Distance::PEARSON) {
+		double ma = 0., mb = 0.;
+		for (size_t i = 0; i < len; ++i) {
+			ma += a[i];
+			mb += b[i];
+		}
+		return correlate(a, b, len, ma / len, mb / len);
+	} else { // Distance::EMD
+		std::vector<double> sa(a, a + len), sb(b, b + len);
+		std::sort(sa.begin(), sa.end());
+		std::sort(sb.begin(), sb.end());
+		return emd_sorted(sa.data(), sb.data(), len);
+	}
 }
 
-template<>
-double distance<Distance::PEARSON>(const std::vector<double> &a, const std::vector<double> &b)
+template<typename T>
+std::function<double(const T *a, const T *b, size_t len)>
+distfun(Distance measure)
 {
-	std::vector<double> aa, bb;
-	cv::subtract(a, cv::mean(a), aa);
-	cv::subtract(b, cv::mean(b), bb);
-	return distance<Distance::CROSSCORREL>(aa, bb);
+	switch (measure) {
+	case Distance::COSINE: return distance<Distance::COSINE, T>;
+	case Distance::CROSSCORREL: return distance<Distance::CROSSCORREL, T>;
+	case Distance::PEARSON: return distance<Distance::PEARSON, T>;
+	case Distance::EMD: return distance<Distance::EMD, T>;
+	default: return distance<Distance::EUCLIDEAN, T>;
+	}
 }
 
-template<>
-double distance<Distance::EMD>(const std::vector<double> &a, const std::vector<double> &b)
+// instantiate for callers that dispatch at compile time, e.g. distmat
+template<typename T>
+using distance_t = double(const T*, const T*, size_t);
+template distance_t<double> distance<Distance::EUCLIDEAN, double>;
+template distance_t<double> distance<Distance::COSINE, double>;
+template distance_t<double> distance<Distance::CROSSCORREL, double>;
+template distance_t<double> distance<Distance::PEARSON, double>;
+template distance_t<double> distance<Distance::EMD, double>;
+template distance_t<float> distance<Distance::EUCLIDEAN, float>;
+template distance_t<float> distance<Distance::COSINE, float>;
+template distance_t<float> distance<Distance::CROSSCORREL, float>;
+template distance_t<float> distance<Distance::PEARSON, float>;
+template distance_t<float> distance<Distance::EMD, float>;
+template distance_t<unsigned short> distance<Distance::EUCLIDEAN, unsigned short>;
+template distance_t<unsigned short> distance<Distance::COSINE, unsigned short>;
+template distance_t<unsigned short> distance<Distance::CROSSCORREL, unsigned short>;
+template distance_t<unsigned short> distance<Distance::PEARSON, unsigned short>;
+template distance_t<unsigned short> distance<Distance::EMD, unsigned short>;
+
+template std::function<double(const double*, const double*, size_t)> distfun<double>(Distance);
+template std::function<double(const float*, const float*, size_t)> distfun<float>(Distance);
+template std::function<double(const unsigned short*, const unsigned short*, size_t)>
+distfun<unsigned short>(Distance);
+
+double distance_scale(Distance measure, double scale)
 {
-	cv::Mat1f ina(a.size(), 1 + 1, 1.f); // weight + value
-	cv::Mat1f inb(b.size(), 1 + 1, 1.f); // weight + value
-	std::copy(a.cbegin(), a.cend(), ina.col(1).begin());
-	std::copy(b.cbegin(), b.cend(), inb.col(1).begin());
-	// use L1 here as we have scalar inputs anyway
-	return (double)cv::EMD(ina, inb, cv::DIST_L1);
+	// all other measures are invariant to scaling
+	if (measure == Distance::EUCLIDEAN || measure == Distance::EMD)
+		return scale;
+	return 1.;
 }
 
-std::function<double(const std::vector<double> &a, const std::vector<double> &b)>
-distfun(Distance measure)
+cv::Mat1d sorted_rows(const matrix &source)
 {
-	switch (measure) {
-	case Distance::COSINE: return distance<Distance::COSINE>;
-	case Distance::CROSSCORREL: return distance<Distance::CROSSCORREL>;
-	case Distance::PEARSON: return distance<Distance::PEARSON>;
-	case Distance::EMD: return distance<Distance::EMD>;
-	default: return distance<Distance::EUCLIDEAN>;
-	}
+	cv::Mat1d ret; // note: fresh output, as input may be shallow copy of source
+	cv::sort(convert(source, Features::Precision::DOUBLE, {}), ret,
+	         cv::SORT_EVERY_ROW | cv::SORT_ASCENDING);
+	return ret;
+}
+
+double emd_sorted(const double *a, const double *b, size_t len)
+{
+	double ret = 0.;
+	for (size_t i = 0; i < len; ++i)
+		ret += std::abs(a[i] - b[i]);
+	return ret / len;
 }
 
-Features::Stats computeStats(const vec &feats, bool withRange, const std::vector<size_t> &filter)
+Features::Stats computeStats(const matrix &feats, bool withRange, const std::vector<size_t> &filter)
 {
 	if (feats.empty())
 		return {};
 
 	Features::Stats ret;
 
-	auto len = feats.front().size();
+	auto len = (size_t)feats.cols;
 	for (auto v : {&ret.mean, &ret.stddev,
 		           &ret.min, &ret.max,
 		           &ret.quant25, &ret.quant50, &ret.quant75})
@@ -228,16 +346,19 @@ Features::Stats computeStats(const vec &feats, bool withRange, const std::vector
 
 	/* compute statistics per-dimension */
 	bool filtered = !filter.empty();
-	auto nFeats = filtered ? filter.size() : feats.size();
-	auto statsPerDim = [&] (unsigned dim) {
+	auto nFeats = filtered ? filter.size() : (size_t)feats.rows;
+	auto statsPerDim = [&] (int dim) {
 		std::vector<double> f(nFeats);
-		if (filtered) {
-			for (size_t j = 0; j < nFeats; ++j)
-				f[j] = feats[filter[j]][dim];
-		} else {
-			for (size_t j = 0; j < nFeats; ++j)
-				f[j] = feats[j][dim];
-		}
+		visit(feats, [&] (auto fs) {
+			if (filtered) {
+				for (size_t j = 0; j < nFeats; ++j)
+					f[j] = fs((int)filter[j], dim) * feats.scale + feats.offset;
+			} else {
+				auto column = fs.col(dim); // strided view
+				std::transform(column.begin(), column.end(), f.begin(),
+				               [s=feats.scale,o=feats.offset] (double v) { return v * s + o; });
+			}
+		});
 
 		cv::Scalar m, s;
 		cv::meanStdDev(f, m, s);
@@ -253,10 +374,10 @@ Features::Stats computeStats(const vec &feats, bool withRange, const std::vector
 	};
 
 	if (nFeats < 1000) {
-		for (size_t i = 0; i < len; ++i)
+		for (int i = 0; i < (int)len; ++i)
 			statsPerDim(i);
 	} else {
-		tbb::parallel_for(size_t(0), len, [&] (size_t i) { statsPerDim(i); });
+		tbb::parallel_for(0, (int)len, [&] (int i) { statsPerDim(i); });
 	}
 
 	// compute overall range afterwards, not to disturb parallel computation above
@@ -5,33 +5,65 @@
 
 namespace features {
 
-using vec = Features::Vec;
+using matrix = Features::Matrix;
+
+/* call fun with a typed view on source: cv::Mat_<double>, cv::Mat_<float> or
+ * cv::Mat_<unsigned short>. Stored values still need to be decoded as
+ * value * source.scale + source.offset */
+template<typename F>
+decltype(auto) visit(const matrix &source, F &&fun)
+{
+	switch (source.depth()) {
+	case CV_32F: return fun(cv::Mat_<float>(source));
+	case CV_16U: return fun(cv::Mat_<unsigned short>(source));
+	default: return fun(cv::Mat_<double>(source));
+	}
+}
+
+Features::Precision precision_of(const matrix &source);
+// convert to given precision; quantization maps [range.min, range.max] onto uint16
+matrix convert(const matrix &source, Features::Precision precision, const Features::Range &range);
+// decoded copy of a single row (shallow for double precision data)
+cv::Mat1d row_of(const matrix &source, int row);
 
 // compute range that includes at least <fraction> of the observed values
-Features::Range range_of(const vec &source, float fraction = 1.f);
+Features::Range range_of(const matrix &source, float fraction = 1.f);
 // obtain a sane range for log-scale on data range
 Features::Range log_valid(const Features::Range &range);
 
 // normalize data to range [0,1] based on given input range
-void normalize(vec& feats, const Features::Range &inputRange);
+void normalize(matrix& feats, const Features::Range &inputRange);
 
 // compute how many vectors would be affected by a cutoff
-unsigned cutoff_effect(const vec& source, double threshold);
+unsigned cutoff_effect(const matrix& source, double threshold);
 // apply threshold on scores (_upper_ limit) by erasing corresp. features
-vec with_cutoff(const vec& feats, const vec &scores, double threshold);
+matrix with_cutoff(const matrix& feats, const matrix &scores, double threshold);
 // version of with_cutoff that also alters scores to reflect new limit
-void apply_cutoff(vec& feats, vec &scores, double threshold);
+void apply_cutoff(matrix& feats, matrix &scores, double threshold);
 
-std::vector<QVector<QPointF>> pointify(const vec &source);
-QVector<QPointF> scatter(const vec &x, size_t xi, const vec &y, size_t yi);
+std::vector<QVector<QPointF>> pointify(const matrix &source);
+QVector<QPointF> scatter(const matrix &x, size_t xi, const matrix &y, size_t yi);
 
-template<Distance D>
-double distance(const std::vector<double> &a, const std::vector<double> &b);
+// distance between two feature vectors of length len, e.g. two rows of a matrix
+template<Distance D, typename T>
+double distance(const T *a, const T *b, size_t len);
 
-std::function<double(const std::vector<double> &a, const std::vector<double> &b)>
+template<typename T>
+std::function<double(const T *a, const T *b, size_t len)>
 distfun(Distance measure);
 
-Features::Stats computeStats(const vec& feats, bool withRange, const std::vector<size_t> &filter = {});
+// factor to obtain distances of actual values from distances of stored values
+// note: COSINE and CROSSCORREL are not invariant to the offset, decode first
+double distance_scale(Distance measure, double scale);
+
+/* Our EMD signatures are scalar values with uniform weights. Then the optimal flow
+ * matches values in sorted order, and EMD is the mean L1 distance of sorted vectors. */
+// decoded copy with each row sorted ascending, as input for emd_sorted()
+cv::Mat1d sorted_rows(const matrix &source);
+// EMD between two sorted vectors of length len
+double emd_sorted(const double *a, const double *b, size_t len);
+
+Features::Stats computeStats(const matrix& feats, bool withRange, const std::vector<size_t> &filter = {});
 
 }
 
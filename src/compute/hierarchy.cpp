@@ -1,154 +1,440 @@
 #include "hierarchy.h"
 #include "jobregistry.h"
 
-#include <queue>
-#include <unordered_set>
+#include <tbb/parallel_for.h>
+
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+#include <utility>
 
 namespace hierarchy
 {
 
-struct Pair {
-	float distance;
-	unsigned left, right;
-	static float closer(const Pair& a, const Pair& b) { return a.distance > b.distance; }
-};
+/* Lance–Williams formula: distance of cluster k to the union of a and b */
+static float update(Linkage linkage, double dak, double dbk, double dab,
+                    double na, double nb, double nk)
+{
+	switch (linkage) {
+	case Linkage::SINGLE: return (float)std::min(dak, dbk);
+	case Linkage::COMPLETE: return (float)std::max(dak, dbk);
+	case Linkage::WARD:
+		return (float)std::sqrt(std::max(0., ((na + nk) * dak * dak + (nb + nk) * dbk * dbk
+		                                      - nk * dab * dab) / (na + nb + nk)));
+	default: // AVERAGE (UPGMA)
+		return (float)((na * dak + nb * dbk) / (na + nb));
+	}
+}
 
-std::unique_ptr<HrClustering> agglomerative(const cv::Mat1f &distances, const std::vector<ProteinId> &proteins) {
-	if (distances.rows != distances.cols || distances.rows != (int)proteins.size())
-		throw std::invalid_argument("Non-square matrix or unmatching protein vector.");
+std::unique_ptr<HrClustering> agglomerative(const SymmetricMatrix &distances,
+                                            const std::vector<ProteinId> &proteins, Linkage linkage) {
+	if (distances.size() != proteins.size())
+		throw std::invalid_argument("Unmatching distance matrix and protein vector.");
 
 	auto jr = JobRegistry::get();
 	if (jr->isCurrentJobCancelled())
 		return {};
 
 	auto ret = std::make_unique<HrClustering>();
-	auto &clusters = ret->clusters;
-	auto total = proteins.size()*2 - 1;
-
-	/* build initial set of clusters */
-	std::vector<std::vector<unsigned>> members(total); // cache for all children of a cluster
-	clusters.resize(total);
-	for (unsigned i = 0; i < proteins.size(); ++i) {
-		auto &cl = clusters[i];
-		cl.protein = proteins[i];
-		members[i] = {i};
-	}
+	if (proteins.empty())
+		return ret;
+	auto n = proteins.size();
 
-	auto avg_dist = [&](unsigned a, unsigned b) {
-		// average linkage (WPGMA)
-		float ret = 0.f;
-		for (auto i : members[a]) {
-			for (auto j : members[b]) {
-				ret += distances(i, j);
-			}
-		}
-		return ret / (members[a].size() * members[b].size());
+	/* working copy of distances, updated in-place on merge */
+	SymmetricMatrix d(n);
+	std::replace_copy_if(distances.begin(), distances.end(), d.row(0),
+	                     [] (float v) { return std::isnan(v); }, std::numeric_limits<float>::max());
+
+	/* nearest-neighbor chain: follow nearest neighbors until two clusters are reciprocal
+	   nearest neighbors, then merge them. Valid for all our linkages (they are reducible). */
+	struct Merge {
+		unsigned a, b; // slots of merged clusters; result stays in slot b
+		float distance;
 	};
+	std::vector<Merge> merges;
+	merges.reserve(n - 1);
+	std::vector<size_t> sizes(n, 1);
+	std::vector<unsigned> active(n); // slots that hold a cluster
+	std::iota(active.begin(), active.end(), 0);
+	std::vector<size_t> position(n); // of slot in active
+	std::iota(position.begin(), position.end(), 0);
+	std::vector<unsigned> chain;
 
-	/* build initial heap of possible pairs for merge */
-	std::priority_queue<Pair, std::vector<Pair>, decltype(&Pair::closer)> pairs(Pair::closer);
-	for (unsigned i = 0; i < proteins.size(); ++i) {
-		if ((i % (proteins.size() / 10)) == 0) {
+	auto step = std::max((n - 1) / 200, size_t(1));
+	while (active.size() > 1) {
+		if ((merges.size() % step) == 0) {
 			if (jr->isCurrentJobCancelled())
 				return {};
-			jr->setCurrentJobProgress(5. * i / proteins.size());
-		}
-		for (unsigned j = 0; j < i; ++j) {
-			pairs.push({avg_dist(i, j), i, j});
+			jr->setCurrentJobProgress(100.f * merges.size() / (n - 1));
 		}
-	}
 
-	/* create whole hierarchy starting from initial set */
-	for (unsigned i = proteins.size(); i < total; ++i) {
-		// note: the progress update mechanic is a bit unsatisfactory, as the last 1% takes longest
-		if ((i % (total / 200)) == 0) {
-			if (jr->isCurrentJobCancelled())
-				return {};
-			jr->setCurrentJobProgress(5. + 91. * (i - proteins.size()) / (total - proteins.size()));
-		}
+		if (chain.empty())
+			chain.push_back(active.front());
 
-		// find viable pair, remove outdated pairs (whose clusters were merged)
-		Pair candidate;
+		unsigned a, b;
 		while (true) {
-			candidate = pairs.top();
-			pairs.pop();
-			if (!members[candidate.left].empty() && !members[candidate.right].empty())
-				break; // we found a pair that is still valid
+			a = chain.back();
+			// prefer predecessor on ties to avoid cycles
+			b = (chain.size() > 1 ? chain[chain.size() - 2] : a);
+			auto best = (b != a ? d(a, b) : std::numeric_limits<float>::infinity());
+			for (auto k : active) {
+				if (k != a && d(a, k) < best) {
+					best = d(a, k);
+					b = k;
+				}
+			}
+			if (chain.size() > 1 && b == chain[chain.size() - 2])
+				break; // reciprocal nearest neighbors
+			chain.push_back(b);
 		}
+		chain.resize(chain.size() - 2);
 
-		// create new cluster and double-link
-		auto &target = clusters[i];
-		target.children = {candidate.left, candidate.right};
-		for (auto c : target.children)
-			clusters[c].parent = i;
-		target.distance = candidate.distance;
-
-		// update members - move all members to new cluster
-		auto &joint = members[i], &left = members[candidate.left], &right = members[candidate.right];
-		joint.swap(left); // clears out left
-		joint.insert(joint.end(), right.begin(), right.end());
-		right.clear();
-
-		// add new candidate pairs (note we tried TBB but it did not increase performance)
-		for (unsigned j = 0; j < i; ++j) {
-			if (members[j].empty())
-				continue;
-			pairs.push({avg_dist(i, j), i, j});
+		/* merge a into b */
+		auto dab = d(a, b);
+		merges.push_back({a, b, dab});
+		for (auto k : active) {
+			if (k != a && k != b)
+				d(b, k) = update(linkage, d(a, k), d(b, k), dab, sizes[a], sizes[b], sizes[k]);
 		}
+		sizes[b] += sizes[a];
+		auto last = active.back();
+		active[position[a]] = last;
+		position[last] = position[a];
+		active.pop_back();
 	}
 
-	// we only went up to 96% before as the last percent is very slow based on algorithm design
-	jr->setCurrentJobProgress(100.f);
+	/* build hierarchy with clusters sorted by merge distance */
+	std::stable_sort(merges.begin(), merges.end(),
+	                 [] (const Merge &x, const Merge &y) { return x.distance < y.distance; });
+
+	auto &clusters = ret->clusters;
+	clusters.resize(2*n - 1);
+	for (unsigned i = 0; i < n; ++i)
+		clusters[i].protein = proteins[i];
+
+	// union-find from slots to current cluster index
+	std::vector<unsigned> label(2*n - 1);
+	std::iota(label.begin(), label.end(), 0);
+	auto find = [&label] (unsigned i) {
+		auto root = i;
+		while (label[root] != root)
+			root = label[root];
+		while (label[i] != root) // path compression
+			i = std::exchange(label[i], root);
+		return root;
+	};
+	for (size_t m = 0; m < merges.size(); ++m) {
+		auto target = (unsigned)(n + m);
+		auto left = find(merges[m].a), right = find(merges[m].b);
+		auto &current = clusters[target];
+		// newer cluster first
+		current.children = {std::max(left, right), std::min(left, right)};
+		current.distance = merges[m].distance;
+		for (auto c : current.children) {
+			clusters[c].parent = target;
+			label[c] = target;
+		}
+	}
 
+	jr->setCurrentJobProgress(100.f);
 	return ret;
 }
 
-Annotations partition(const HrClustering &in, unsigned granularity)
+std::shared_ptr<const HrClustering::CutIndex> index(const HrClustering &in)
 {
 	auto &hrclusters = in.clusters;
+	auto size = (unsigned)hrclusters.size();
+	auto ret = std::make_shared<HrClustering::CutIndex>();
+	ret->splitBelow.assign(size, 0);
+	ret->root.assign(size, true);
+
+	/* a cluster is split if it is above the bound and so is any of its children */
+	for (unsigned i = 0; i < size; ++i) {
+		auto &children = hrclusters[i].children;
+		if (children.empty())
+			continue;
+		unsigned maxChild = 0;
+		for (auto c : children) {
+			ret->root[c] = false;
+			maxChild = std::max(maxChild, c);
+		}
+		ret->splitBelow[i] = std::min(i, maxChild) + 1;
+	}
+
+	/* depth-first order, first child first, for members in tree order */
+	ret->topDown.reserve(size);
+	std::vector<unsigned> stack;
+	for (unsigned i = 0; i < size; ++i) {
+		if (!ret->root[i])
+			continue;
+		stack.push_back(i);
+		while (!stack.empty()) {
+			auto current = stack.back();
+			stack.pop_back();
+			ret->topDown.push_back(current);
+			auto &children = hrclusters[current].children;
+			stack.insert(stack.end(), children.rbegin(), children.rend());
+		}
+	}
+	return ret;
+}
+
+/* leaf ordering tree: leaves are numbered in hierarchy order, so each node covers a
+ * contiguous range [begin, end) of positions that is split at mid into its children */
+struct OrderingNode {
+	unsigned begin, mid, end;
+	int left, right; // node index, -1 for single leaf
+};
 
-	granularity = std::min(granularity, (unsigned)hrclusters.size());
-	unsigned lowBound = hrclusters.size() - granularity - 1;
+/* range of leaves in child that may be adjacent to the other child, if x is at the far end */
+static std::pair<unsigned, unsigned> outerRange(const std::vector<OrderingNode> &nodes, int child, unsigned x)
+{
+	if (child < 0)
+		return {x, x + 1};
+	auto &c = nodes[(size_t)child];
+	return (x < c.mid ? std::make_pair(c.mid, c.end) : std::make_pair(c.begin, c.mid));
+}
 
-	/* determine clusters to be displayed */
-	std::unordered_set<unsigned> candidates;
-	// we use the fact that input is sorted by distance, ascending
-	for (auto i = lowBound; i < hrclusters.size(); ++i) {
+std::vector<unsigned> optimalLeafOrder(const HrClustering &in, const SymmetricMatrix &distances,
+                                       const std::unordered_map<ProteinId, unsigned> &index)
+{
+	auto jr = JobRegistry::get();
+	auto cuts = (in.cuts ? in.cuts : hierarchy::index(in));
+	auto &hrclusters = in.clusters;
+
+	/* restrict hierarchy to our proteins, in default (depth-first) order */
+	struct Span {
+		unsigned begin = 0, end = 0;
+		int node = -1;
+	};
+	std::vector<Span> spans(hrclusters.size());
+	std::vector<unsigned> leaves; // positions to distance matrix indices
+	for (auto i : cuts->topDown) {
 		auto &current = hrclusters[i];
+		if (!current.protein || !current.children.empty())
+			continue;
+		auto it = index.find(current.protein.value_or(0)); // MacOS
+		if (it == index.end())
+			continue;
+		spans[i] = {(unsigned)leaves.size(), (unsigned)leaves.size() + 1};
+		leaves.push_back(it->second);
+	}
 
-		// add either parent or childs, if any of them is eligible by-itself
-		auto useChildrenInstead =
-		        std::any_of(current.children.begin(), current.children.end(),
-		                    [lowBound] (auto c) { return c >= lowBound; });
-		if (useChildrenInstead) {
-			for (auto c : current.children) {
-				if (c < lowBound) // only add what's not covered by granularity
-					candidates.insert(c);
+	/* build binary nodes bottom-up, skipping empty children; more than two children,
+	 * or several roots, are joined from left to right */
+	std::vector<OrderingNode> nodes;
+	auto join = [&nodes] (const auto &parts) {
+		Span acc;
+		for (auto &part : parts) {
+			if (part.begin == part.end)
+				continue;
+			if (acc.begin == acc.end) {
+				acc = part;
+				continue;
 			}
-		} else {
-			candidates.insert(i);
+			nodes.push_back({acc.begin, acc.end, part.end, acc.node, part.node});
+			acc = {acc.begin, part.end, (int)nodes.size() - 1};
+		}
+		return acc;
+	};
+	std::vector<Span> parts, roots;
+	for (auto it = cuts->topDown.rbegin(); it != cuts->topDown.rend(); ++it) {
+		auto &children = hrclusters[*it].children;
+		if (!children.empty()) {
+			parts.clear();
+			for (auto c : children)
+				parts.push_back(spans[c]);
+			spans[*it] = join(parts);
 		}
 	}
+	for (auto i : cuts->topDown) {
+		if (cuts->root[i])
+			roots.push_back(spans[i]);
+	}
+	join(roots);
+
+	auto n = leaves.size();
+	if (nodes.empty())
+		return leaves; // nothing to decide
+
+	auto d = [&] (unsigned a, unsigned b) { return distances(leaves[a], leaves[b]); };
+
+	/* cost of optimal ordering of a node's leaves, from leaf i to leaf j, where
+	 * i and j are in different children of the node (Bar-Joseph et al., 2001).
+	 * Each pair of leaves belongs to exactly one node, so we start with their
+	 * distance, which is only needed at that node, and overwrite it there. */
+	SymmetricMatrix cost(n);
+	tbb::parallel_for(size_t(0), n, [&] (size_t i) {
+		auto out = cost.row(i) - i;
+		for (auto j = i; j < n; ++j)
+			out[j] = d((unsigned)i, (unsigned)j);
+		out[i] = 0.f;
+	});
+
+	const auto inf = std::numeric_limits<float>::infinity();
+	double pairsDone = 0., pairsTotal = double(n) * (n - 1) / 2.;
+	for (auto &v : nodes) {
+		if (jr->isCurrentJobCancelled())
+			return {};
+
+		auto width = v.end - v.mid;
+		auto leftSplit = (v.left < 0 ? v.mid : nodes[(size_t)v.left].mid);
+		auto rightSplit = (v.right < 0 ? v.end : nodes[(size_t)v.right].mid);
+
+		/* lower bounds of d(k, m) for both possible ranges of k, used for pruning */
+		std::vector<float> minDist[2] = {std::vector<float>(width, inf), std::vector<float>(width, inf)};
+		tbb::parallel_for(v.mid, v.end, [&] (unsigned m) {
+			for (auto k = v.begin; k < v.mid; ++k) {
+				auto &target = minDist[k < leftSplit ? 0 : 1][m - v.mid];
+				target = std::min(target, cost(k, m));
+			}
+		});
+
+		/* best path from i to any m in the right child, via k at the inner end of the left */
+		std::vector<float> toM(size_t(v.mid - v.begin) * width, inf);
+		std::vector<float> minToM(2 * size_t(v.mid - v.begin), inf);
+		tbb::parallel_for(v.begin, v.mid, [&] (unsigned i) {
+			auto r = outerRange(nodes, v.left, i);
+			std::vector<std::pair<float, unsigned>> ks;
+			for (auto k = r.first; k < r.second; ++k)
+				ks.push_back({cost(i, k), k});
+			std::sort(ks.begin(), ks.end());
+
+			auto &bounds = minDist[r.first < leftSplit ? 0 : 1];
+			auto row = toM.data() + size_t(i - v.begin) * width - v.mid;
+			std::vector<unsigned> active(width);
+			std::iota(active.begin(), active.end(), v.mid);
+			for (auto &[c, k] : ks) {
+				auto dk = cost.row(k) - k;
+				size_t kept = 0;
+				for (auto m : active) {
+					if (c + bounds[m - v.mid] >= row[m])
+						continue; // cannot improve anymore
+					row[m] = std::min(row[m], c + dk[m]);
+					active[kept++] = m;
+				}
+				active.resize(kept);
+				if (active.empty())
+					break;
+			}
+
+			// lower bounds for both possible ranges of m, used for pruning
+			auto bound = minToM.data() + 2 * size_t(i - v.begin);
+			for (auto m = v.mid; m < v.end; ++m) {
+				auto &target = bound[m < rightSplit ? 0 : 1];
+				target = std::min(target, row[m]);
+			}
+		});
 
+		/* candidates m for each j, sorted by cost(m, j), used for pruning */
+		std::vector<unsigned> offsets(width + 1, 0);
+		for (auto j = v.mid; j < v.end; ++j) {
+			auto r = outerRange(nodes, v.right, j);
+			offsets[j - v.mid + 1] = offsets[j - v.mid] + (r.second - r.first);
+		}
+		std::vector<std::pair<float, unsigned>> candidates(offsets.back());
+		tbb::parallel_for(v.mid, v.end, [&] (unsigned j) {
+			auto r = outerRange(nodes, v.right, j);
+			auto first = candidates.begin() + offsets[j - v.mid];
+			for (auto m = r.first; m < r.second; ++m)
+				first[m - r.first] = {cost(m, j), m};
+			std::sort(first, first + (r.second - r.first));
+		});
+
+		/* best path from i to j, via m at the inner end of the right child */
+		tbb::parallel_for(size_t(0), toM.size(), [&] (size_t index) {
+			auto i = v.begin + unsigned(index / width), j = v.mid + unsigned(index % width);
+			auto row = toM.data() + size_t(i - v.begin) * width - v.mid;
+			auto range = outerRange(nodes, v.right, j);
+			auto bound = minToM[2 * size_t(i - v.begin) + (range.first < rightSplit ? 0 : 1)];
+			float best = inf;
+			for (auto o = offsets[j - v.mid]; o < offsets[j - v.mid + 1]; ++o) {
+				auto [c, m] = candidates[o];
+				if (c + bound >= best)
+					break;
+				best = std::min(best, row[m] + c);
+			}
+			cost(i, j) = best;
+		});
+
+		pairsDone += double(v.mid - v.begin) * width;
+		jr->setCurrentJobProgress(float(100. * pairsDone / pairsTotal));
+	}
+
+	/* pick best end points and trace back, depth-first */
+	auto &top = nodes.back();
+	std::pair<unsigned, unsigned> ends = {top.begin, top.mid};
+	for (auto i = top.begin; i < top.mid; ++i) {
+		for (auto j = top.mid; j < top.end; ++j) {
+			if (cost(i, j) < cost(ends.first, ends.second))
+				ends = {i, j};
+		}
+	}
+
+	struct Segment {
+		int node;
+		unsigned from, to;
+	};
+	std::vector<Segment> stack = {{(int)nodes.size() - 1, ends.first, ends.second}};
+	std::vector<unsigned> ret;
+	ret.reserve(n);
+	while (!stack.empty()) {
+		auto s = stack.back();
+		stack.pop_back();
+		if (s.node < 0) {
+			ret.push_back(leaves[s.from]);
+			continue;
+		}
+
+		/* find inner ends k, m of the two children that realize the optimal cost */
+		auto &v = nodes[(size_t)s.node];
+		auto first = (s.from < v.mid ? v.left : v.right), second = (s.from < v.mid ? v.right : v.left);
+		auto kr = outerRange(nodes, first, s.from), mr = outerRange(nodes, second, s.to);
+		float best = inf;
+		std::pair<unsigned, unsigned> inner = {kr.first, mr.first};
+		for (auto k = kr.first; k < kr.second; ++k) {
+			for (auto m = mr.first; m < mr.second; ++m) {
+				auto c = (cost(s.from, k) + d(k, m)) + cost(m, s.to);
+				if (c < best) {
+					best = c;
+					inner = {k, m};
+				}
+			}
+		}
+		stack.push_back({second, inner.second, s.to});
+		stack.push_back({first, s.from, inner.first});
+	}
+	return ret;
+}
+
+Annotations partition(const HrClustering &in, unsigned granularity)
+{
+	auto &hrclusters = in.clusters;
+	auto cuts = (in.cuts ? in.cuts : index(in));
 	Annotations ret;
 
-	// helper to recursively assign all proteins to clusters
-	std::function<void(unsigned, unsigned)> flood;
-	flood = [&] (unsigned hIndex, unsigned cIndex) {
-		auto &current = hrclusters[hIndex];
+	auto size = (unsigned)hrclusters.size();
+	granularity = std::min(granularity, std::max(size, 1u) - 1);
+	unsigned lowBound = size - granularity - 1;
+
+	/* walk down the tree, the uppermost unsplit clusters are the ones displayed;
+	 * input is sorted by distance, ascending, so the bound cuts off the top */
+	std::vector<unsigned> assignment(size);
+	for (auto i : cuts->topDown) {
+		if (cuts->root[i])
+			assignment[i] = i;
+		bool split = lowBound < cuts->splitBelow[i];
+		auto &current = hrclusters[i];
+		if (!split && assignment[i] == i) {
+			// use index in hierarchy as cluster index as well
+			ret.groups[i].name = QString("Cluster #%1").arg(size - i); // initializes
+		}
 		if (current.protein)
 			// would use std::optional::value(), but not available on MacOS 10.13
-			ret.groups.at(cIndex).members.push_back(current.protein.value_or(0));
+			ret.groups.at(assignment[i]).members.push_back(current.protein.value_or(0));
 		for (auto c : current.children)
-			flood(c, cIndex);
-	};
-
-	ret.groups.reserve(candidates.size());
-	for (auto i : candidates) {
-		auto name = QString("Cluster #%1").arg(hrclusters.size() - i);
-		// use index in hierarchy as cluster index as well
-		ret.groups[i].name = name; // initializes
-		flood(i, i);
+			assignment[c] = (split ? c : assignment[i]);
 	}
 
 	auto name = QString("%2 at granularity %1").arg(granularity).arg(in.meta.name);
@@ -4,11 +4,22 @@
 #include "model.h"
 
 #include <memory>
+#include <unordered_map>
 
 namespace hierarchy {
 
-std::unique_ptr<HrClustering> agglomerative(const cv::Mat1f &distances, const std::vector<ProteinId> &proteins);
+std::unique_ptr<HrClustering> agglomerative(const SymmetricMatrix &distances, const std::vector<ProteinId> &proteins,
+                                            Linkage linkage = Linkage::AVERAGE);
+// build index for partition(), stored in HrClustering::cuts
+std::shared_ptr<const HrClustering::CutIndex> index(const HrClustering &in);
+// cut hierarchy into clusters, O(n) with index
 Annotations partition(const HrClustering &in, unsigned granularity);
+/* order leaves for least sum of distances between neighbors, while keeping the tree;
+ * returns indices into distances for proteins in index; empty if cancelled.
+ * Memory: a cost matrix the size of distances, plus buffers of up to the same size
+ * again at the root (|left| x |right| floats, up to |right|^2 / 2 pairs) */
+std::vector<unsigned> optimalLeafOrder(const HrClustering &in, const SymmetricMatrix &distances,
+                                       const std::unordered_map<ProteinId, unsigned> &index);
 
 }
 
@@ -0,0 +1,45 @@
+#ifndef ALIGNEDROWS_H
+#define ALIGNEDROWS_H
+
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace seg_meanshift {
+
+/* rows of equal length in one block. Each row starts at a 64-byte boundary and is
+ * zero-padded to a multiple of 64 bytes, so kernels can work on full SIMD vectors of
+ * the padded length (stride) without remainder. Move-only. */
+template<typename T>
+class AlignedRows
+{
+public:
+	static constexpr size_t alignment = 64; // cache line, AVX-512 vector
+
+	AlignedRows() = default;
+	AlignedRows(size_t rows, size_t cols)
+	    : rows_(rows), cols_(cols),
+	      stride_((cols * sizeof(T) + alignment - 1) / alignment * alignment / sizeof(T)),
+	      storage(new T[rows * stride_ + alignment / sizeof(T)]()) // zero-initialized
+	{
+		auto address = reinterpret_cast<std::uintptr_t>(storage.get());
+		data = storage.get() + (alignment - address % alignment) % alignment / sizeof(T);
+	}
+
+	size_t rows() const { return rows_; }
+	size_t cols() const { return cols_; }
+	size_t stride() const { return stride_; } // padded row length
+	bool empty() const { return rows_ == 0; }
+
+	T* operator[](size_t row) { return data + row * stride_; }
+	const T* operator[](size_t row) const { return data + row * stride_; }
+
+protected:
+	size_t rows_ = 0, cols_ = 0, stride_ = 0;
+	std::unique_ptr<T[]> storage;
+	T *data = nullptr;
+};
+
+}
+
+#endif
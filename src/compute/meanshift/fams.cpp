@@ -28,7 +28,6 @@
 #include <iterator>
 #include <functional>
 #include <tbb/parallel_for.h>
-#include <tbb/parallel_reduce.h>
 
 namespace seg_meanshift {
 
@@ -44,17 +43,18 @@ FAMS::~FAMS() {
 #endif
 
 void FAMS::resetState() {
-	progress = progress_old = 0.;
-	jobId = JobRegistry::get()->getCurrentJob().id; // 0 if there is no job
+	progress = 0.f;
+	progress_old = 0.f;
+	job = JobRegistry::getCurrentSlot(); // empty if there is no job
 	cancelled = false;
-	modes = std::vector<Mode>(modes.size());
+	modes.window.assign(modes.window.size(), 0);
 	prunedModes = {};
 	prunedIndex = {};
 }
 
 // Choose a subset of points on which to perform the mean shift operation
 void FAMS::selectStartPoints(double percent, int jump) {
-	if (datapoints.empty())
+	if (points.empty())
 		return;
 
 	size_t selectionSize;
@@ -66,68 +66,30 @@ void FAMS::selectStartPoints(double percent, int jump) {
 
 	if (selectionSize != startPoints.size()) {
 		startPoints.resize(selectionSize);
-		modes.resize(selectionSize);
+		modes = {AlignedRows<unsigned short>(selectionSize, d_),
+		         std::vector<unsigned int>(selectionSize, 0)};
 	}
 
 	if (percent > 0.) {
 		for (size_t i = 0; i < startPoints.size();  i++)
-			startPoints[i] = &datapoints[(int)(drand48() * n_) % n_];
+			startPoints[i] = (unsigned int)(drand48() * n_) % n_;
 	} else {
 		for (size_t i = 0; i < startPoints.size(); i++)
-			startPoints[i] = &datapoints[i * jump];
+			startPoints[i] = (unsigned int)(i * jump);
 	}
 }
 
-void FAMS::importStartPoints(std::vector<Point> &points)
+void FAMS::ComputePilotPoint::operator()(const tbb::blocked_range<int> &r) const
 {
-	/* add all points as starting points */
-	startPoints.resize(points.size());
-	for (size_t i = 0; i < points.size(); ++i)
-		startPoints[i] = &points[i];
-	modes.resize(startPoints.size());
-}
-
-void FAMS::ComputePilotPoint::operator()(const tbb::blocked_range<int> &r)
-{
-	const int thresh = (int)(fams.config.k * std::sqrt((float)fams.n_));
-	const int win_j = 10, max_win = 7000;
-	const int mwpwj = max_win / win_j;
-	unsigned int nn;
-	unsigned int wjd = (unsigned int)(win_j * fams.d_);
-
+	auto &pilot = fams.pilot;
+	std::vector<unsigned int> distances(pilot.k);
 	int done = 0;
 	for (int j = r.begin(); j != r.end(); ++j) {
-		int numn = 0;
-		int numns[mwpwj];
-		memset(numns, 0, sizeof(numns));
-
-		for (unsigned int i = 0; i < fams.n_; i++) {
-			nn = fams.DistL1(fams.datapoints[j], fams.datapoints[i]) / wjd; // TODO L2
-			if (nn < mwpwj)
-				numns[nn]++;
-		}
-
-		// determine distance to k-nearest neighbour
-		for (nn = 0; nn < mwpwj; nn++) {
-			numn += numns[nn];
-			if (numn > thresh) {
-				break;
-			}
-		}
-
-		if (numn <= thresh) {
-			dbg_noknn++;
-		}
-
-		fams.datapoints[j].window = (nn + 1) * wjd;
-		fams.datapoints[j].weightdp2 = pow(
-					FAMS_FLOAT_SHIFT / fams.datapoints[j].window,
-					(fams.d_ + 2) * FAMS_ALPHA);
-		if (weights) {
-			fams.datapoints[j].weightdp2 *= (*weights)[j];
-		}
-
-		dbg_acc += fams.datapoints[j].window;
+		fams.neighbors->nearestDistances(fams.points[j], pilot.k,
+		                                 pilot.limit, distances.data());
+		auto target = &pilot.bins[(size_t)j * pilot.k];
+		for (size_t i = 0; i < pilot.k; ++i)
+			target[i] = (unsigned short)(std::min(distances[i], pilot.limit) / pilot.binSize);
 
 		if (fams.n_ < 50 || (++done % (fams.n_ / 50)) == 0) {
 			bool cont = fams.progressUpdate((float)done/(float)fams.n_ * 10.f,
@@ -146,13 +108,53 @@ void FAMS::ComputePilotPoint::operator()(const tbb::blocked_range<int> &r)
 bool FAMS::ComputePilot(std::vector<double> *weights) {
 	std::cerr << "compute bandwidths..." << std::endl;
 
-	ComputePilotPoint comp(*this, weights);
-	tbb::parallel_reduce(tbb::blocked_range<int>(0, n_),
-						 comp);
+	const int thresh = (int)(config.k * std::sqrt((float)n_));
+	const int win_j = 10, max_win = 7000;
+	const int mwpwj = max_win / win_j;
+	unsigned int wjd = (unsigned int)(win_j * WindowUnit());
+
+	/* find neighbors, unless known from previous run with same or larger k */
+	auto k = (size_t)thresh + 1; // the point itself counts
+	if (pilot.k < k) {
+		// leave headroom for k to be increased a bit, without need to recompute
+		pilot.k = std::max(k, std::min(2 * k, (size_t)n_));
+		// distances are binned by wjd, and only mwpwj bins are considered
+		pilot.binSize = wjd;
+		pilot.limit = mwpwj * wjd;
+		pilot.bins.resize(n_ * pilot.k);
+		tbb::parallel_for(tbb::blocked_range<int>(0, n_), ComputePilotPoint(*this));
+		if (cancelled) {
+			pilot = {}; // incomplete
+			return false;
+		}
+	} else {
+		progressUpdate(10.f, false);
+	}
 
-	std::cerr << "Avg. window size: " << comp.dbg_acc / n_ << std::endl;
+	long long dbg_acc = 0; // can go over limit of 32 bit integer
+	unsigned int dbg_noknn = 0;
+	for (unsigned int j = 0; j < n_; j++) {
+		// determine distance to k-nearest neighbour
+		unsigned int nn = pilot.bins[j * pilot.k + k - 1];
+		if (nn >= mwpwj) {
+			nn = mwpwj;
+			dbg_noknn++;
+		}
+
+		datapoints.window[j] = (nn + 1) * wjd;
+		datapoints.weightdp2[j] = pow(
+					FAMS_FLOAT_SHIFT / datapoints.window[j],
+					(d_ + 2) * FAMS_ALPHA);
+		if (weights) {
+			datapoints.weightdp2[j] *= (*weights)[j];
+		}
+
+		dbg_acc += datapoints.window[j];
+	}
+
+	std::cerr << "Avg. window size: " << dbg_acc / n_ << std::endl;
 	std::cerr << "No kNN found for " << std::setprecision(2) <<
-	             comp.dbg_noknn / n_ * 100.f << "% of all points" << std::endl;
+	             dbg_noknn / n_ * 100.f << "% of all points" << std::endl;
 
 	return !(cancelled);
 }
@@ -163,14 +165,14 @@ void FAMS::ComputeRealBandwidths(unsigned int h) {
 	const int    win_j = 10, max_win = 7000;
 	unsigned int nn;
 	unsigned int wjd;
-	wjd =        (unsigned int)(win_j * d_);
+	wjd =        (unsigned int)(win_j * WindowUnit());
 	if (h == 0) {
 		for (size_t j = 0; j < startPoints.size(); j++) {
 			int numn = 0;
 			int numns[max_win / win_j];
 			memset(numns, 0, sizeof(numns));
 			for (unsigned int i = 0; i < n_; i++) {
-				nn = DistL1(*startPoints[j], datapoints[i]) / wjd;
+				nn = Dist(points[startPoints[j]], points[i], max_win / win_j * wjd) / wjd;
 				if (nn < max_win / win_j)
 					numns[nn]++;
 			}
@@ -180,11 +182,11 @@ void FAMS::ComputeRealBandwidths(unsigned int h) {
 					break;
 				}
 			}
-			startPoints[j]->window = (nn + 1) * win_j;
+			datapoints.window[startPoints[j]] = (nn + 1) * win_j;
 		}
 	} else{
 		for (size_t j = 0; j < startPoints.size(); j++) {
-			startPoints[j]->window = h;
+			datapoints.window[startPoints[j]] = h;
 		}
 	}
 }
@@ -194,22 +196,25 @@ unsigned int FAMS::DoMSAdaptiveIteration(const std::vector<unsigned short> &old,
 										 std::vector<unsigned short> &ret) const
 {
 	double total_weight = 0;
-	std::vector<double> rr(d_, 0.);
+	std::vector<double> rr(points.stride(), 0.);
 	unsigned int crtH = 0;
 	double       hmdist = 1e100;
-	for (auto &ptp : datapoints) {
-		auto [inside, dist] = DistL1(old, ptp, ptp.window); // TODO L2
-		if (!inside)
-		    continue;
-
-		double x = 1.0 - (dist / ptp.window);
-		double w = ptp.weightdp2 * x * x * ptp.factor;
+	// all points that have old within their window, in order of datapoints
+	std::vector<VPTree<Distance>::Hit> hits;
+	neighbors->withinWindows(old.data(), hits);
+	bool l2 = (config.metric == Config::Metric::L2);
+	for (auto [index, distance] : hits) {
+		auto window = datapoints.window[index];
+		double dist = distance;
+		// biweight kernel profile in L2, its historic counterpart in L1
+		double u = dist / window;
+		double x = 1.0 - (l2 ? u * u : u);
+		double w = datapoints.weightdp2[index] * x * x * datapoints.factor[index];
 		total_weight += w;
-		for (size_t j = 0; j < ptp.data->size(); j++)
-		    rr[j] += (*ptp.data)[j] * w;
+		kernels::accumulate(rr.data(), points[index], w, rr.size());
 		if (dist < hmdist) {
 			hmdist = dist;
-			crtH   = ptp.window;
+			crtH   = window;
 		}
 	}
 	if (total_weight == 0) {
@@ -221,28 +226,58 @@ unsigned int FAMS::DoMSAdaptiveIteration(const std::vector<unsigned short> &old,
 	return crtH;
 }
 
+size_t FAMS::visitCell(const std::vector<unsigned short> &position) const
+{
+	size_t ret = 0;
+	for (auto v : position) // boost::hash_combine
+		ret ^= std::hash<unsigned>{}(v / visitCellSize) + 0x9e3779b9 + (ret << 6) + (ret >> 2);
+	return ret;
+}
+
+int FAMS::findBasin(const std::vector<unsigned short> &position, unsigned int window) const
+{
+	// note: close positions in different cells are missed, which only costs time
+	auto tolerance = window >> FAMS_CAPTURE_HDIV;
+	auto range = visits.equal_range(visitCell(position));
+	for (auto it = range.first; it != range.second; ++it) {
+		if (Dist(position.data(), it->second.position.data(), tolerance) < tolerance)
+			return (int)it->second.mode;
+	}
+	return -1;
+}
+
 void FAMS::MeanShiftPoint::operator()(const tbb::blocked_range<int> &r)
 const
 {
-	// initialize mean vectors to zero
+	// initialize mean vectors to zero, padded like points
+	auto stride = fams.points.stride();
 	std::vector<unsigned short>
-			oldMean(fams.d_, 0),
-			crtMean(fams.d_, 0);
+			oldMean(stride, 0),
+			crtMean(stride, 0);
 	unsigned int *crtWindow;
+	std::vector<std::vector<unsigned short>> path;
 
 	int done = 0;
 	for (int jj = r.begin(); jj != r.end(); ++jj) {
 
 		// update mode's window directly
-		crtWindow  = &fams.modes[jj].window;
+		crtWindow  = &fams.modes.window[jj];
 		// set initial values
-		Point *p = fams.startPoints[jj];
-		crtMean    = *p->data;
-		*crtWindow = p->window;
+		auto p = fams.startPoints[jj];
+		crtMean.assign(fams.points[p], fams.points[p] + stride);
+		*crtWindow = fams.datapoints.window[p];
+		path.clear();
+		int basin = -1;
 
 		for (int iter = 0; oldMean != crtMean && (iter < FAMS_MAXITER);
 			 iter++) {
 			oldMean = crtMean;
+			if (fams.config.captureTrajectories) {
+				basin = fams.findBasin(oldMean, *crtWindow);
+				if (basin >= 0)
+					break;
+				path.push_back(oldMean);
+			}
 			unsigned newWindow = fams.DoMSAdaptiveIteration(oldMean, crtMean);
 			if (!newWindow) {
 				// oldMean is final mean -> break loop
@@ -251,11 +286,21 @@ const
 			*crtWindow = newWindow;
 		}
 
-		// algorithm converged, store result if we do not already know it
-		if (fams.modes[jj].data.empty()) {
-			fams.modes[jj].data = crtMean;
+		// algorithm converged, store result
+		auto target = fams.modes.data[jj];
+		if (basin >= 0) {
+			std::copy(fams.modes.data[basin], fams.modes.data[basin] + stride, target);
+			*crtWindow = fams.modes.window[basin];
+		} else {
+			std::copy(crtMean.begin(), crtMean.end(), target);
+			basin = jj;
 		}
 
+		// share path after the round (see finishFAMS()); it leads to the same mode
+		auto &shared = fams.pendingVisits[jj];
+		for (auto &position : path)
+			shared.push_back({std::move(position), (unsigned)basin});
+
 		// progress reporting
 		if (fams.startPoints.size() < 90*4 ||
 		    (++done % (fams.startPoints.size() / 90*4)) == 0) {
@@ -275,10 +320,35 @@ const
 // perform FAMS starting from a subset of the data points.
 // return true on successful finish (not cancelled by user through update feedback)
 bool FAMS::finishFAMS() {
-	std::cerr << " Start MS iterations" << std::endl;
-
-	tbb::parallel_for(tbb::blocked_range<int>(0, startPoints.size()),
-	                  MeanShiftPoint(*this));
+	std::cerr << " Start MS iterations (" << kernels::isa() << ")" << std::endl;
+
+	/* trajectories are captured by paths within a fraction of their window;
+	 * use the average as grid cell size for the lookup */
+	visits.clear();
+	unsigned long long windowSum = 0;
+	for (auto p : startPoints)
+		windowSum += datapoints.window[p];
+	auto meanWindow = (startPoints.empty() ? 0 : windowSum / startPoints.size());
+	visitCellSize = std::max(1u, (unsigned int)meanWindow >> FAMS_CAPTURE_HDIV);
+
+	/* start points run in rounds of doubling size. Trajectories are only captured by
+	 * paths of earlier rounds, shared in point order, so that the result does not
+	 * depend on thread scheduling */
+	auto total = (int)startPoints.size();
+	pendingVisits.assign(startPoints.size(), {});
+	int round = (config.captureTrajectories ? FAMS_CAPTURE_ROUND : total);
+	for (int begin = 0; begin < total && !cancelled; begin += round, round *= 2) {
+		auto end = std::min(total, begin + round);
+		tbb::parallel_for(tbb::blocked_range<int>(begin, end), MeanShiftPoint(*this));
+		for (int jj = begin; jj < end; ++jj) {
+			for (auto &v : pendingVisits[jj])
+				visits.emplace(visitCell(v.position), std::move(v));
+			pendingVisits[jj] = {};
+		}
+	}
+	// only needed during the run, also when cancelled
+	visits.clear();
+	pendingVisits.clear();
 
 	std::cerr << "done." << std::endl;
 	return !(cancelled);
@@ -286,7 +356,7 @@ bool FAMS::finishFAMS() {
 
 // initialize bandwidths
 bool FAMS::prepareFAMS(std::vector<double> *bandwidths, std::vector<double> *factors) {
-	assert(!datapoints.empty());
+	assert(!points.empty());
 
 	//Compute pilot if necessary
 	std::cerr << " Run pilot ";
@@ -302,29 +372,31 @@ bool FAMS::prepareFAMS(std::vector<double> *bandwidths, std::vector<double> *fac
 			double width = bandwidths->at(i) * config.bandwidth;
 			unsigned int hWidth = value2ushort<unsigned int>(width);
 
-			datapoints[i].window = hWidth;
-			datapoints[i].weightdp2 = pow(
-						FAMS_FLOAT_SHIFT / datapoints[i].window,
+			datapoints.window[i] = hWidth;
+			datapoints.weightdp2[i] = pow(
+						FAMS_FLOAT_SHIFT / datapoints.window[i],
 						(d_ + 2) * FAMS_ALPHA);
 		}
 	} else {  // fixed bandwidth for all points
 		int hWidth = value2ushort<int>(config.bandwidth);
-		unsigned int hwd = (unsigned int)(hWidth * d_);
+		unsigned int hwd = (unsigned int)(hWidth * WindowUnit());
 		std::cerr << "fixed bandwidth (global value), window size " << hwd << std::endl;
 		for (unsigned int i = 0; i < n_; i++) {
-			datapoints[i].window    = hwd;
-			datapoints[i].weightdp2 = 1;
+			datapoints.window[i]    = hwd;
+			datapoints.weightdp2[i] = 1;
 		}
 	}
 
+	/* windows changed, update index */
+	neighbors->setWindows(datapoints.window);
+
 	/* Set factors */
 	if (factors) {
 		std::cerr << " *** using factors *** ";
 		for (unsigned int i = 0; i < n_; i++)
-			datapoints[i].factor = factors->at(i);
+			datapoints.factor[i] = factors->at(i);
 	} else {
-		for (unsigned int i = 0; i < n_; i++)
-			datapoints[i].factor = 1.;
+		datapoints.factor.assign(n_, 1.);
 	}
 
 	std::cerr <<  "done." << std::endl;
@@ -333,32 +405,37 @@ bool FAMS::prepareFAMS(std::vector<double> *bandwidths, std::vector<double> *fac
 
 bool FAMS::progressUpdate(float percent, bool absolute)
 {
-	auto job = JobRegistry::get()->job(jobId);
-	if (job.isValid() && job.isCancelled)
+	if (job && job->cancelled)
 		cancelled = true;
 
 	if (cancelled)
 		return false;
 
-	if (!job.isValid() && config.verbosity < 1)
+	if (!job && config.verbosity < 1)
 		return true;
 
-	std::scoped_lock _(progressMutex);
-	if (absolute)
-		progress = percent;
-	else
-		progress += percent;
-
-	if (progress > progress_old + 0.5f) {
-		progress_old = progress;
-		if (job.isValid()) {
-			JobRegistry::get()->setJobProgress(jobId, progress);
-		} else {
-			std::cerr << "\r" << progress << " %          \r";
-			std::cerr.flush();
-		}
+	/* called from worker threads, so accumulate without locking */
+	float current;
+	if (absolute) {
+		current = percent;
+		progress = current;
+	} else {
+		current = progress;
+		while (!progress.compare_exchange_weak(current, current + percent));
+		current += percent;
 	}
 
+	if (job) {
+		job->progress = current; // monitors sample it
+		return true;
+	}
+
+	std::scoped_lock _(progressMutex);
+	if (current > progress_old + 0.5f) {
+		progress_old = current;
+		std::cerr << "\r" << current << " %          \r";
+		std::cerr.flush();
+	}
 	return true;
 }
 
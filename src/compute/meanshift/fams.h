@@ -10,6 +10,11 @@
 #ifndef FAMS_H
 #define FAMS_H
 
+#include "alignedrows.h"
+#include "kernels.h"
+#include "vptree.h"
+#include "jobregistry.h"
+
 #include <QVector>
 
 #include <opencv2/core.hpp> // for timer functionality
@@ -18,9 +23,11 @@
 #include <cmath>
 #include <cstdarg>
 #include <cstdio>
+#include <atomic>
 #include <limits>
-#include <emmintrin.h>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 
 namespace seg_meanshift {
 
@@ -39,6 +46,10 @@ namespace seg_meanshift {
 #define FAMS_ALPHA         1.0
 // float shift used for dp2, no idea what it really is supposed to do
 #define FAMS_FLOAT_SHIFT     100000.0
+// divison of window (as shift) in which a trajectory is captured by a known one
+#define FAMS_CAPTURE_HDIV    3
+// start points in the first round of trajectory capture, later rounds double
+#define FAMS_CAPTURE_ROUND   256
 
 /* Prune Modes */
 // window size (in 2^16 units) in which modes are joined
@@ -71,35 +82,45 @@ public:
 
 		/// minimum number of points per reported mode (after pruning)
 		int pruneMinN = 50;
+
+		/// stop trajectories that reach the path of one converged in an earlier round
+		bool captureTrajectories = true;
+
+		/// distance used for windows and kernel; set before importPoints()
+		enum class Metric {
+			L1,
+			L2
+		} metric = Metric::L1;
 	};
 
-	struct Point {
-		std::vector<unsigned short> *data;
-		// size of ms window around this point (L1)
-		unsigned int   window;
-		// pre-calculated valeu based on window
-		double         weightdp2;
+	/* per-point values, as struct of arrays; data of point i is points[i] */
+	struct Points {
+		// size of ms window around each point (in config.metric)
+		std::vector<unsigned int> window;
+		// pre-calculated value based on window
+		std::vector<double> weightdp2;
 		// factor used outside kernel
-		double factor;
+		std::vector<double> factor;
 	};
 
-	struct Mode {
-		std::vector<unsigned short> data;
-		unsigned int window;
+	/* modes found per start point, rows padded like points */
+	struct Modes {
+		AlignedRows<unsigned short> data;
+		std::vector<unsigned int> window;
 	};
 
 	// used for mode pruning, defined in mode_pruning.cpp
 	struct MergedMode {
 		MergedMode() {}
-		MergedMode(const FAMS::Mode &d, int m, int spm);
+		MergedMode(const unsigned short *mode, size_t dims, int m, int spm);
 
 		// compare sizes for DESCENDING sort
 		static inline bool cmpSize(const MergedMode& a, const MergedMode& b)
 		{	return (a.spmembers > b.spmembers);	}
 
 		std::vector<unsigned short> normalized() const;
-		double distTo(const FAMS::Mode &m) const;
-		void add(const FAMS::Mode &m, int sp);
+		double distTo(const unsigned short *mode, Config::Metric metric) const;
+		void add(const unsigned short *mode, int sp);
 		bool invalidateIfSmall(int smallest);
 
 		std::vector<float> data;
@@ -108,23 +129,13 @@ public:
 		bool valid;
 	};
 
+	// fills the pilot cache
 	struct ComputePilotPoint {
-		ComputePilotPoint(FAMS& master, std::vector<double> *weights = nullptr)
-			: fams(master), weights(weights), dbg_acc(0.), dbg_noknn(0) {}
-		ComputePilotPoint(ComputePilotPoint& other, tbb::split)
-			: fams(other.fams), weights(other.weights),
-			  dbg_acc(0.), dbg_noknn(0) {}
-		void operator()(const tbb::blocked_range<int> &r);
-		void join(ComputePilotPoint &other)
-		{
-			dbg_acc += other.dbg_acc;
-			dbg_noknn += other.dbg_noknn;
-		}
+		ComputePilotPoint(FAMS& master)
+			: fams(master) {}
+		void operator()(const tbb::blocked_range<int> &r) const;
 
 		FAMS& fams;
-		std::vector<double> *weights;
-		long long dbg_acc; // can go over limit of 32 bit integer
-		unsigned int dbg_noknn;
 	};
 
 	struct MeanShiftPoint {
@@ -141,15 +152,18 @@ public:
 	FAMS(Config config);
 	~FAMS();
 
-	const auto& getPoints() const { return datapoints; }
+	const auto& getPoints() const { return points; }
 	const auto& getModes() const { return prunedModes; }
 	const auto& getModePerPoint() const { return prunedIndex; }
 
-	bool importPoints(const std::vector<std::vector<double>> &features, bool normalize = false);
+	// features are double, float or unsigned short, with actual values = stored * scale + offset
+	/* read points, decoded by scale and offset. Without normalization, values in [minVal, maxVal] are
+	 * mapped onto our internal range; normalized vectors always use [0, 1] */
+	bool importPoints(const cv::Mat &features, bool normalize = false, double scale = 1.,
+	                  double offset = 0., double minVal = 0., double maxVal = 1.);
 	void selectStartPoints(double percent, int jump);
-	void importStartPoints(std::vector<Point> &points);
 	// returns a vector of pruned modes (sorted by size)
-	std::vector<std::vector<double>> exportModes() const;
+	cv::Mat1d exportModes() const;
 
 	void resetState();
 
@@ -171,71 +185,38 @@ public:
 	{
 		return in * (maxVal_ - minVal_) / 65535. + minVal_;
 	}
+	// for lengths (e.g. bandwidths), not coordinates
 	template <typename T>
 	inline T value2ushort(double in) const
 	{
-		double scale = 65535. / (maxVal_ - minVal_);
-		return (in - minVal_) / scale;
+		return in * 65535. / (maxVal_ - minVal_);
 	}
 
-	union m128i_uint {
-		__m128i v;
-		unsigned int i[4];
-	};
-
-	// distance in L1 between two data elements
-	inline unsigned int DistL1(Point& in_pt1, Point& in_pt2) const
+	// distance between two padded rows (see AlignedRows); may stop early at bound
+	inline unsigned int Dist(const unsigned short *in_1, const unsigned short *in_2,
+	                         unsigned int bound = std::numeric_limits<unsigned int>::max()) const
 	{
-		size_t i = 0;
-		unsigned int ret = 0;
-		if (in_pt1.data->size() > 7) {
-			__m128i vret = _mm_setzero_si128(), vzero = _mm_setzero_si128();
-			for (; i < in_pt1.data->size() - 8; i += 8) {
-				unsigned short *p1 = &(*in_pt1.data)[i];
-				unsigned short *p2 = &(*in_pt2.data)[i];
-				__m128i vec1 = _mm_loadu_si128((__m128i*)p1);
-				__m128i vec2 = _mm_loadu_si128((__m128i*)p2);
-				__m128i v1i1 = _mm_unpacklo_epi16(vec1, vzero);
-				__m128i v1i2 = _mm_unpackhi_epi16(vec1, vzero);
-				__m128i v2i1 = _mm_unpacklo_epi16(vec2, vzero);
-				__m128i v2i2 = _mm_unpackhi_epi16(vec2, vzero);
-				__m128i diff1 = _mm_sub_epi32(v1i1, v2i1);
-				__m128i diff2 = _mm_sub_epi32(v1i2, v2i2);
-				__m128i mask1 = _mm_srai_epi32(diff1, 31); // shift 32-1 bits
-				__m128i mask2 = _mm_srai_epi32(diff2, 31);
-				__m128i abs1 = _mm_xor_si128(_mm_add_epi32(diff1, mask1), mask1);
-				__m128i abs2 = _mm_xor_si128(_mm_add_epi32(diff2, mask2), mask2);
-				vret = _mm_add_epi32(abs1, _mm_add_epi32(abs2, vret));
-			}
-			m128i_uint *unpack = (m128i_uint*)&vret;
-			ret += unpack->i[0];
-			ret += unpack->i[1];
-			ret += unpack->i[2];
-			ret += unpack->i[3];
-		}
-		for (; i < in_pt1.data->size(); i++) {
-			ret += abs((*in_pt1.data)[i] - (*in_pt2.data)[i]);
-		}
-
-		return ret;
+		if (config.metric == Config::Metric::L2)
+			return kernels::distL2(in_1, in_2, points.stride(), bound);
+		return kernels::distL1(in_1, in_2, points.stride(), bound);
 	}
 
-	/*
-	   a boolean function which computes the distance if it is less than threshold.
-	   Not using SSE due to early abortion.
-	 */
-	inline std::tuple<bool, double> DistL1(const std::vector<unsigned short> &d1,
-	                       const Point& pt2, double thresh) const
+	// unit of window sizes, grows with dimensionality like distances do in the metric
+	inline double WindowUnit() const
 	{
-		double dist = 0.;
-		for (size_t i = 0; i < d1.size() && (dist < thresh); i++)
-			dist += abs(d1[i] - (*pt2.data)[i]);
-		return {(dist < thresh), dist};
+		return (config.metric == Config::Metric::L2 ? std::sqrt((double)d_) : (double)d_);
 	}
 
 	unsigned int n_, d_; // number of points, number of dimensions
 
 protected:
+	struct Distance {
+		unsigned int operator()(const unsigned short *a, const unsigned short *b,
+		                        unsigned int bound) const
+		{ return fams->Dist(a, b, bound); }
+		const FAMS *fams;
+	};
+
 	bool ComputePilot(std::vector<double> *weights = nullptr);
 	unsigned int DoMSAdaptiveIteration(const std::vector<unsigned short> &old,
 	        std::vector<unsigned short> &ret) const;
@@ -245,27 +226,58 @@ protected:
 
 	// helper functions to pruneModes()
 	static std::pair<double, int>
-	findClosest(const Mode &mode, const std::vector<MergedMode> &foomodes);
+	findClosest(const unsigned short *mode, const std::vector<MergedMode> &foomodes,
+	            Config::Metric metric);
 	void trimModes(std::vector<MergedMode> &foomodes, int npmin, bool sp,
 				   size_t allowance = std::numeric_limits<size_t>::max());
 
 	// interval of input data
 	double minVal_, maxVal_;
 
+	// input data, one row per point
+	AlignedRows<unsigned short> points;
 	// input points
-	std::vector<Point> datapoints;
+	Points datapoints;
+
+	// spatial index over datapoints, for pilot and mean shift iterations
+	std::unique_ptr<VPTree<Distance>> neighbors;
+
+	/* binned distances to nearest neighbors of each point, independent of config.k.
+	 * Kept between runs, so that changing k only needs to re-derive windows. */
+	struct PilotCache {
+		// neighbors per point, 0 when invalid
+		size_t k = 0;
+		// distances are binned; distances at or above limit are not considered
+		unsigned int binSize = 1, limit = 0;
+		// n_ × k, ascending per point, limit / binSize when out of reach
+		std::vector<unsigned short> bins;
+	} pilot;
+
+	/* positions on paths of converged trajectories, by grid cell, see findBasin();
+	 * only kept during finishFAMS() */
+	struct Visit {
+		std::vector<unsigned short> position;
+		// index in modes, of a trajectory that ran until convergence
+		unsigned mode;
+	};
+	// read-only during a round, filled in point order in between
+	std::unordered_multimap<size_t, Visit> visits;
+	// paths of the current round, by start point
+	std::vector<std::vector<Visit>> pendingVisits;
+	unsigned int visitCellSize = 1;
 
-	// input data, in case we need to store it ourselves
-	std::vector<std::vector<unsigned short>> dataholder;
+	size_t visitCell(const std::vector<unsigned short> &position) const;
+	// mode of a converged path passing close to position, -1 if none
+	int findBasin(const std::vector<unsigned short> &position, unsigned int window) const;
 
-	// selected points on which MS is run
-	std::vector<Point*> startPoints;
+	// indices of selected points on which MS is run
+	std::vector<unsigned int> startPoints;
 
 	// modes derived for these points
-	std::vector<Mode> modes;
+	Modes modes;
 
 	// final result of mode pruning
-	std::vector<std::vector<unsigned short>> prunedModes;
+	AlignedRows<unsigned short> prunedModes;
 
 	// index of each pixel regarding to prunedModes
 	std::vector<int> prunedIndex;
@@ -277,9 +289,12 @@ public:
 	Config config;
 
 protected:
-	bool cancelled = false;
-	unsigned jobId = 0;
-	float progress = 0.f, progress_old = 0.f;
+	std::atomic<bool> cancelled = false;
+	// progress and cancellation of the job we run in, if any
+	std::shared_ptr<JobRegistry::Slot> job;
+	std::atomic<float> progress = 0.f;
+	// for console output only
+	float progress_old = 0.f;
 	std::mutex progressMutex;
 };
 
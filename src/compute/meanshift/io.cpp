@@ -11,66 +11,80 @@ using namespace std;
 
 namespace seg_meanshift {
 
-bool FAMS::importPoints(const std::vector<std::vector<double>>& features, bool normalize) {
+bool FAMS::importPoints(const cv::Mat& features, bool normalize, double scale,
+                        double offset, double minVal, double maxVal) {
 	// w_ and h_ are only used for result output (i.e. in io.cpp)
-	n_ = features.size();
-	d_ = features.at(0).size(); // dimensionality
+	n_ = (size_t)features.rows;
+	d_ = (size_t)features.cols; // dimensionality
 
-	minVal_ = 0;
-	maxVal_ = 1;
+	// normalized vectors have components in [0, 1]
+	minVal_ = (normalize ? 0. : minVal);
+	maxVal_ = (normalize ? 1. : maxVal);
+	if (maxVal_ <= minVal_) // degenerate range, avoid division by zero
+		maxVal_ = minVal_ + 1.;
 
 	// convert to internal unsigned short representation
-	dataholder.resize(n_);
+	points = AlignedRows<unsigned short>(n_, d_);
 	for (unsigned i = 0; i < n_; ++i) {
-		auto &source = features[i];
-		auto &target = dataholder[i];
-		target.resize(d_);
+		auto source = features.row((int)i);
 
-		double factor = 65535.;
+		double n = 1.;
 		if (normalize) {
-			double n = cv::norm(source, cv::NORM_L2);
+			if (offset == 0.) {
+				n = cv::norm(source, cv::NORM_L2) * scale;
+			} else {
+				cv::Mat1d decoded;
+				source.convertTo(decoded, CV_64F, scale, offset);
+				n = cv::norm(decoded, cv::NORM_L2);
+			}
 			if (n == 0.)
 				n = 1.;
 			// if (n < 1.)
 			//	std::cerr << i << "\t" << n << std::endl;
-			factor /= n;
 		}
 
-		for (unsigned j = 0; j < d_; ++j)
-			target[j] = (unsigned short)(source[j] * factor);
+		// map [minVal_, maxVal_] of the decoded (and normalized) values onto the full range
+		double factor = 65535. / (maxVal_ - minVal_);
+		// convert directly into our storage, whatever the input type
+		cv::Mat1w wrapper(1, (int)d_, points[i]);
+		source.convertTo(wrapper, CV_16U, factor * scale / n, factor * (offset / n - minVal_));
 	}
 
-	// link points to their data
-	datapoints.resize(dataholder.size());
-	for (size_t i = 0; i < dataholder.size(); ++i) {
-		datapoints[i].data = &dataholder[i];
-	}
+	datapoints.window.assign(n_, 0);
+	datapoints.weightdp2.assign(n_, 0.);
+	datapoints.factor.assign(n_, 1.);
+
+	std::vector<const unsigned short*> rows(n_);
+	for (size_t i = 0; i < n_; ++i)
+		rows[i] = points[i];
+	neighbors = std::make_unique<VPTree<Distance>>(std::move(rows), Distance{this});
+	pilot = {};
 	return true;
 }
 
-std::vector<std::vector<double>> FAMS::exportModes() const {
-	std::vector<std::vector<double>> ret;
-	for (const auto& src : prunedModes) {
-		std::vector<double> dest(d_);
-		for (size_t d = 0; d < src.size(); ++d)
+cv::Mat1d FAMS::exportModes() const {
+	cv::Mat1d ret((int)prunedModes.rows(), (int)d_);
+	for (size_t i = 0; i < prunedModes.rows(); ++i) {
+		auto src = prunedModes[i];
+		auto dest = ret[(int)i];
+		for (size_t d = 0; d < d_; ++d)
 			dest[d] = ushort2value(src[d]);
-		ret.push_back(std::move(dest));
 	}
 	return ret;
 }
 
 void FAMS::saveModes(const std::string& filename, bool pruned) {
 
-	size_t n = (pruned ? prunedModes.size() : modes.size());
+	size_t n = (pruned ? prunedModes.rows() : modes.data.rows());
 	if (n < 1)
 		return;
 
 	FILE* fd = fopen((filename).c_str(), "wb");
 
 	for (size_t i = 0; i < n; ++i) {
-		std::vector<unsigned short> &src
-				= (pruned ? prunedModes[i] : modes[i].data);
-		for (size_t d = 0; d < src.size(); ++d) {
+		const unsigned short *src
+				= (pruned ? prunedModes[i] : modes.data[i]);
+		for (size_t d = 0; d < d_; ++d) {
 			fprintf(fd, "%g ", ushort2value(src[d]));
 		}
 		fprintf(fd, "\n");
@@ -0,0 +1,321 @@
+#include "kernels.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+
+namespace seg_meanshift {
+namespace kernels {
+
+/* Note: we compile for a conservative baseline (see cmake/flags.cmake), so that
+ * binaries run on older machines. Wider variants are enabled per function. */
+
+/* distances are summed in blocks, checking the bound in between */
+static constexpr size_t distBlock = 64;
+
+static unsigned int absDiff(const unsigned short *a, const unsigned short *b, size_t begin, size_t end)
+{
+	unsigned int ret = 0;
+	for (size_t i = begin; i < end; ++i)
+		ret += std::abs(a[i] - b[i]);
+	return ret;
+}
+
+static unsigned int distL1_sse2(const unsigned short *a, const unsigned short *b, size_t d,
+                                unsigned int bound)
+{
+	unsigned int total = 0;
+	__m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m128i sum = _mm_setzero_si128();
+		for (; i + 8 <= end; i += 8) {
+			auto va = _mm_loadu_si128((const __m128i*)(a + i));
+			auto vb = _mm_loadu_si128((const __m128i*)(b + i));
+			// absolute difference of unsigned shorts, without the need to widen first
+			auto diff = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+			sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(diff, zero));
+			sum = _mm_add_epi32(sum, _mm_unpackhi_epi16(diff, zero));
+		}
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		total += (unsigned int)_mm_cvtsi128_si32(sum) + absDiff(a, b, i, end);
+		i = end;
+		if (total >= bound)
+			break;
+	}
+	return total;
+}
+
+__attribute__((target("avx2")))
+static unsigned int distL1_avx2(const unsigned short *a, const unsigned short *b, size_t d,
+                                unsigned int bound)
+{
+	unsigned int total = 0;
+	__m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m256i sum = _mm256_setzero_si256();
+		for (; i + 16 <= end; i += 16) {
+			auto va = _mm256_loadu_si256((const __m256i*)(a + i));
+			auto vb = _mm256_loadu_si256((const __m256i*)(b + i));
+			auto diff = _mm256_or_si256(_mm256_subs_epu16(va, vb), _mm256_subs_epu16(vb, va));
+			sum = _mm256_add_epi32(sum, _mm256_unpacklo_epi16(diff, zero));
+			sum = _mm256_add_epi32(sum, _mm256_unpackhi_epi16(diff, zero));
+		}
+		auto half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+		half = _mm_hadd_epi32(half, half);
+		half = _mm_hadd_epi32(half, half);
+		total += (unsigned int)_mm_cvtsi128_si32(half) + absDiff(a, b, i, end);
+		i = end;
+		if (total >= bound)
+			break;
+	}
+	return total;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static unsigned int distL1_avx512(const unsigned short *a, const unsigned short *b, size_t d,
+                                  unsigned int bound)
+{
+	unsigned int total = 0;
+	__m512i zero = _mm512_setzero_si512();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m512i sum = _mm512_setzero_si512();
+		for (; i < end; i += 32) {
+			// masked loads cover the remainder
+			__mmask32 mask = (end - i >= 32 ? ~__mmask32(0) : (__mmask32(1) << (end - i)) - 1);
+			auto va = _mm512_maskz_loadu_epi16(mask, a + i);
+			auto vb = _mm512_maskz_loadu_epi16(mask, b + i);
+			auto diff = _mm512_or_si512(_mm512_subs_epu16(va, vb), _mm512_subs_epu16(vb, va));
+			sum = _mm512_add_epi32(sum, _mm512_unpacklo_epi16(diff, zero));
+			sum = _mm512_add_epi32(sum, _mm512_unpackhi_epi16(diff, zero));
+		}
+		total += (unsigned int)_mm512_reduce_add_epi32(sum);
+		i = end;
+		if (total >= bound)
+			break;
+	}
+	return total;
+}
+
+// smallest integer that is not below the square root
+static unsigned int ceilSqrt(uint64_t sq)
+{
+	auto ret = (uint64_t)std::sqrt((double)sq);
+	while (ret * ret > sq)
+		--ret;
+	while (ret * ret < sq)
+		++ret;
+	return (unsigned int)ret;
+}
+
+static uint64_t sqDiff(const unsigned short *a, const unsigned short *b, size_t begin, size_t end)
+{
+	uint64_t ret = 0;
+	for (size_t i = begin; i < end; ++i) {
+		uint64_t diff = (uint64_t)std::abs(a[i] - b[i]);
+		ret += diff * diff;
+	}
+	return ret;
+}
+
+/* squares of 16 bit differences do not fit into 32 bit signed multiplies (madd),
+ * so we widen to 32 bit and multiply into 64 bit lanes */
+static unsigned int distL2_sse2(const unsigned short *a, const unsigned short *b, size_t d,
+                                unsigned int bound)
+{
+	const uint64_t boundSq = (uint64_t)bound * bound;
+	uint64_t total = 0;
+	__m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m128i sum = _mm_setzero_si128();
+		for (; i + 8 <= end; i += 8) {
+			auto va = _mm_loadu_si128((const __m128i*)(a + i));
+			auto vb = _mm_loadu_si128((const __m128i*)(b + i));
+			auto diff = _mm_or_si128(_mm_subs_epu16(va, vb), _mm_subs_epu16(vb, va));
+			auto lo = _mm_unpacklo_epi16(diff, zero), hi = _mm_unpackhi_epi16(diff, zero);
+			sum = _mm_add_epi64(sum, _mm_mul_epu32(lo, lo));
+			sum = _mm_add_epi64(sum, _mm_mul_epu32(hi, hi));
+			lo = _mm_srli_epi64(lo, 32);
+			hi = _mm_srli_epi64(hi, 32);
+			sum = _mm_add_epi64(sum, _mm_mul_epu32(lo, lo));
+			sum = _mm_add_epi64(sum, _mm_mul_epu32(hi, hi));
+		}
+		alignas(16) uint64_t lanes[2];
+		_mm_store_si128((__m128i*)lanes, sum);
+		total += lanes[0] + lanes[1] + sqDiff(a, b, i, end);
+		i = end;
+		if (total >= boundSq)
+			break;
+	}
+	return ceilSqrt(total);
+}
+
+__attribute__((target("avx2")))
+static unsigned int distL2_avx2(const unsigned short *a, const unsigned short *b, size_t d,
+                                unsigned int bound)
+{
+	const uint64_t boundSq = (uint64_t)bound * bound;
+	uint64_t total = 0;
+	__m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m256i sum = _mm256_setzero_si256();
+		for (; i + 16 <= end; i += 16) {
+			auto va = _mm256_loadu_si256((const __m256i*)(a + i));
+			auto vb = _mm256_loadu_si256((const __m256i*)(b + i));
+			auto diff = _mm256_or_si256(_mm256_subs_epu16(va, vb), _mm256_subs_epu16(vb, va));
+			auto lo = _mm256_unpacklo_epi16(diff, zero), hi = _mm256_unpackhi_epi16(diff, zero);
+			sum = _mm256_add_epi64(sum, _mm256_mul_epu32(lo, lo));
+			sum = _mm256_add_epi64(sum, _mm256_mul_epu32(hi, hi));
+			lo = _mm256_srli_epi64(lo, 32);
+			hi = _mm256_srli_epi64(hi, 32);
+			sum = _mm256_add_epi64(sum, _mm256_mul_epu32(lo, lo));
+			sum = _mm256_add_epi64(sum, _mm256_mul_epu32(hi, hi));
+		}
+		alignas(32) uint64_t lanes[4];
+		_mm256_store_si256((__m256i*)lanes, sum);
+		total += lanes[0] + lanes[1] + lanes[2] + lanes[3] + sqDiff(a, b, i, end);
+		i = end;
+		if (total >= boundSq)
+			break;
+	}
+	return ceilSqrt(total);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static unsigned int distL2_avx512(const unsigned short *a, const unsigned short *b, size_t d,
+                                  unsigned int bound)
+{
+	const uint64_t boundSq = (uint64_t)bound * bound;
+	uint64_t total = 0;
+	__m512i zero = _mm512_setzero_si512();
+	size_t i = 0;
+	while (i < d) {
+		auto end = std::min(i + distBlock, d);
+		__m512i sum = _mm512_setzero_si512();
+		for (; i < end; i += 32) {
+			// masked loads cover the remainder
+			__mmask32 mask = (end - i >= 32 ? ~__mmask32(0) : (__mmask32(1) << (end - i)) - 1);
+			auto va = _mm512_maskz_loadu_epi16(mask, a + i);
+			auto vb = _mm512_maskz_loadu_epi16(mask, b + i);
+			auto diff = _mm512_or_si512(_mm512_subs_epu16(va, vb), _mm512_subs_epu16(vb, va));
+			auto lo = _mm512_unpacklo_epi16(diff, zero), hi = _mm512_unpackhi_epi16(diff, zero);
+			sum = _mm512_add_epi64(sum, _mm512_mul_epu32(lo, lo));
+			sum = _mm512_add_epi64(sum, _mm512_mul_epu32(hi, hi));
+			lo = _mm512_srli_epi64(lo, 32);
+			hi = _mm512_srli_epi64(hi, 32);
+			sum = _mm512_add_epi64(sum, _mm512_mul_epu32(lo, lo));
+			sum = _mm512_add_epi64(sum, _mm512_mul_epu32(hi, hi));
+		}
+		total += (uint64_t)_mm512_reduce_add_epi64(sum);
+		i = end;
+		if (total >= boundSq)
+			break;
+	}
+	return ceilSqrt(total);
+}
+
+/* Note: we multiply and add separately, as FMA would change rounding. The compiler must
+ * not fuse them either (AVX-512F implies FMA), see -ffp-contract=off in CMakeLists.txt */
+static void accumulate_sse2(double *target, const unsigned short *row, double weight, size_t d)
+{
+	size_t i = 0;
+	auto w = _mm_set1_pd(weight);
+	for (; i + 2 <= d; i += 2) {
+		auto v = _mm_cvtepi32_pd(_mm_setr_epi32(row[i], row[i + 1], 0, 0));
+		_mm_storeu_pd(target + i, _mm_add_pd(_mm_loadu_pd(target + i), _mm_mul_pd(v, w)));
+	}
+	for (; i < d; ++i)
+		target[i] += row[i] * weight;
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(double *target, const unsigned short *row, double weight, size_t d)
+{
+	size_t i = 0;
+	auto w = _mm256_set1_pd(weight);
+	for (; i + 4 <= d; i += 4) {
+		auto v = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(row + i))));
+		_mm256_storeu_pd(target + i, _mm256_add_pd(_mm256_loadu_pd(target + i), _mm256_mul_pd(v, w)));
+	}
+	for (; i < d; ++i)
+		target[i] += row[i] * weight;
+}
+
+__attribute__((target("avx512f")))
+static void accumulate_avx512(double *target, const unsigned short *row, double weight, size_t d)
+{
+	size_t i = 0;
+	auto w = _mm512_set1_pd(weight);
+	for (; i + 8 <= d; i += 8) {
+		auto v = _mm512_cvtepi32_pd(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row + i))));
+		_mm512_storeu_pd(target + i, _mm512_add_pd(_mm512_loadu_pd(target + i), _mm512_mul_pd(v, w)));
+	}
+	for (; i < d; ++i)
+		target[i] += row[i] * weight;
+}
+
+struct Dispatch {
+	Dispatch() {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+			distL1 = distL1_avx512;
+			distL2 = distL2_avx512;
+			accumulate = accumulate_avx512;
+			name = "AVX-512";
+		} else if (__builtin_cpu_supports("avx2")) {
+			distL1 = distL1_avx2;
+			distL2 = distL2_avx2;
+			accumulate = accumulate_avx2;
+			name = "AVX2";
+		}
+	}
+
+	decltype(&distL1_sse2) distL1 = distL1_sse2;
+	decltype(&distL2_sse2) distL2 = distL2_sse2;
+	decltype(&accumulate_sse2) accumulate = accumulate_sse2;
+	const char *name = "SSE2";
+};
+
+// note: function-local static, as kernels may be used during static initialization
+static const Dispatch& dispatch()
+{
+	static const Dispatch instance;
+	return instance;
+}
+
+unsigned int distL1(const unsigned short *a, const unsigned short *b, size_t d,
+                    unsigned int bound)
+{
+	return dispatch().distL1(a, b, d, bound);
+}
+
+unsigned int distL2(const unsigned short *a, const unsigned short *b, size_t d,
+                    unsigned int bound)
+{
+	return dispatch().distL2(a, b, d, bound);
+}
+
+void accumulate(double *target, const unsigned short *row, double weight, size_t d)
+{
+	dispatch().accumulate(target, row, weight, d);
+}
+
+const char *isa()
+{
+	return dispatch().name;
+}
+
+}
+}
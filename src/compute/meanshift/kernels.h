@@ -0,0 +1,31 @@
+#ifndef FAMS_KERNELS_H
+#define FAMS_KERNELS_H
+
+#include <cstddef>
+
+namespace seg_meanshift {
+
+/* inner loops of FAMS, in variants for SSE2, AVX2 and AVX-512 that are chosen
+ * by CPU features at runtime. All variants give identical results. */
+namespace kernels {
+
+/* L1 distance between two rows of d elements. Stops early once bound is reached,
+ * then returns a value of at least bound that is not larger than the distance. */
+unsigned int distL1(const unsigned short *a, const unsigned short *b, size_t d,
+                    unsigned int bound);
+
+/* L2 distance between two rows of d elements, rounded up (keeps the triangle
+ * inequality). Stops early like distL1(). */
+unsigned int distL2(const unsigned short *a, const unsigned short *b, size_t d,
+                    unsigned int bound);
+
+// target += weight * row, on d elements
+void accumulate(double *target, const unsigned short *row, double weight, size_t d);
+
+// name of the instruction set in use
+const char *isa();
+
+}
+}
+
+#endif
@@ -4,15 +4,13 @@
 #include <algorithm>
 #include <limits>
 #include <iostream>
+#include <cmath>
 
 namespace seg_meanshift {
 
-FAMS::MergedMode::MergedMode(const FAMS::Mode &d, int m, int spm)
-    : data(d.data.size()), members(m), spmembers(spm), valid(true)
-	{
-		for (size_t i = 0; i < data.size(); ++i)
-			data[i] = d.data[i];
-}
+FAMS::MergedMode::MergedMode(const unsigned short *mode, size_t dims, int m, int spm)
+    : data(mode, mode + dims), members(m), spmembers(spm), valid(true)
+{}
 
 std::vector<unsigned short> FAMS::MergedMode::normalized() const
 {
@@ -22,18 +20,25 @@ std::vector<unsigned short> FAMS::MergedMode::normalized() const
 	return ret;
 }
 
-double FAMS::MergedMode::distTo(const Mode &m) const
+double FAMS::MergedMode::distTo(const unsigned short *mode, Config::Metric metric) const
 {
 	double ret = 0.;
+	if (metric == Config::Metric::L2) {
+		for (size_t i = 0; i < data.size(); ++i) {
+			double diff = data[i] / members - mode[i];
+			ret += diff * diff;
+		}
+		return std::sqrt(ret);
+	}
 	for (size_t i = 0; i < data.size(); ++i)
-		ret += (double)std::abs(data[i] / members - m.data[i]);
+		ret += (double)std::abs(data[i] / members - mode[i]);
 	return ret;
 }
 
-void FAMS::MergedMode::add(const Mode &m, int sp)
+void FAMS::MergedMode::add(const unsigned short *mode, int sp)
 {
 	for (size_t i = 0; i < data.size(); ++i)
-		data[i] += m.data[i];
+		data[i] += mode[i];
 
 	members++;
 	spmembers += sp;
@@ -49,7 +54,8 @@ bool FAMS::MergedMode::invalidateIfSmall(int smallest)
 }
 
 std::pair<double, int>
-FAMS::findClosest(const Mode& mode, const std::vector<MergedMode> &foomodes) {
+FAMS::findClosest(const unsigned short *mode, const std::vector<MergedMode> &foomodes,
+                  Config::Metric metric) {
 	// distance and index
 	auto closest = std::make_pair(std::numeric_limits<double>::infinity(), -1);
 
@@ -57,7 +63,7 @@ FAMS::findClosest(const Mode& mode, const std::vector<MergedMode> &foomodes) {
 		if (!foomodes[i].valid)
 			continue;
 
-		double dist = foomodes[i].distTo(mode);
+		double dist = foomodes[i].distTo(mode, metric);
 		if (dist < closest.first) {
 			closest.first = dist;
 			closest.second = i;
@@ -93,41 +99,41 @@ void FAMS::trimModes(std::vector<MergedMode> &foomodes,
 
 void FAMS::pruneModes()
 {
-	if (modes.empty())
+	if (modes.data.empty())
 		return;
 
 	// use local copy of prune min. to be able to adapt it
 	int npmin = config.pruneMinN;
 	// compute jump		TODO: uses max. 10,000 points?
-	int jm = (int)ceil(((double)modes.size()) / FAMS_PRUNE_MAXP);
+	int jm = (int)ceil(((double)modes.data.rows()) / FAMS_PRUNE_MAXP);
 
 	//** PASS ONE **//
 
 	// set first mode
 	std::vector<MergedMode> foomodes;
-	foomodes.push_back(MergedMode(modes[0], 1,
+	foomodes.push_back(MergedMode(modes.data[0], d_, 1,
 					   (spsizes.empty() ? 1 : spsizes[0])));
 
 	int nInvalid = 0; // for statistics on invalidated modes
 
-	for (size_t cm = 1; cm < modes.size(); cm += jm) {
+	for (size_t cm = 1; cm < modes.data.rows(); cm += jm) {
 
 		/* compute closest mode */
-		std::pair<double, int> closest = findClosest(modes[cm], foomodes);
+		std::pair<double, int> closest = findClosest(modes.data[cm], foomodes, config.metric);
 
 		/* join */
 
 		// good & cheap indicator for serious failure in DoFAMS()
-		assert(modes[cm].window > 0);
+		assert(modes.window[cm] > 0);
 
 		// closest mode is in range, so add point to it
-		if (closest.first < (modes[cm].window >> FAMS_PRUNE_HDIV)) { // maybe *d_?
+		if (closest.first < (modes.window[cm] >> FAMS_PRUNE_HDIV)) { // maybe *d_?
 			int index = closest.second;
 
 			// merge into mode
-			foomodes[index].add(modes[cm], (spsizes.empty() ? 1 : spsizes[cm]));
+			foomodes[index].add(modes.data[cm], (spsizes.empty() ? 1 : spsizes[cm]));
 		} else { // out of range, assume a new mode
-			foomodes.push_back(MergedMode(modes[cm], 1,
+			foomodes.push_back(MergedMode(modes.data[cm], d_, 1,
 									   (spsizes.empty() ? 1 : spsizes[cm])));
 		}
 
@@ -157,33 +163,34 @@ void FAMS::pruneModes()
 	if (!spsizes.empty())
 		npmin = 1;
 
-	for (size_t cm = 0; cm < modes.size(); ++cm) {
+	for (size_t cm = 0; cm < modes.data.rows(); ++cm) {
 
 		/* compute closest mode */
-		std::pair<double, int> closest = findClosest(modes[cm], foomodes);
+		std::pair<double, int> closest = findClosest(modes.data[cm], foomodes, config.metric);
 
 		/* join -- this time don't care for window size */
 		assert(closest.second >= 0);
 		int index = closest.second;
 
 		// merge into mode
-		foomodes[index].add(modes[cm], (spsizes.empty() ? 1 : spsizes[cm]));
+		foomodes[index].add(modes.data[cm], (spsizes.empty() ? 1 : spsizes[cm]));
 	}
 
 	/* Trim modes, second time */
 	trimModes(foomodes, npmin, false);
 
 	/* store all relevant modes. */
-	prunedModes.resize(foomodes.size());
+	prunedModes = AlignedRows<unsigned short>(foomodes.size(), d_);
 	for (size_t i = 0; i < foomodes.size(); ++i) {
-		prunedModes[i] = foomodes[i].normalized();
+		auto mode = foomodes[i].normalized();
+		std::copy(mode.begin(), mode.end(), prunedModes[i]);
 	}
 
 	/* Now that we finally have a proper set of modes, last round to assign a
 	 * mode index to each pixel. */
-	prunedIndex.resize(modes.size());
-	for (size_t cm = 0; cm < modes.size(); ++cm) {
-		std::pair<double, int> closest = findClosest(modes[cm], foomodes);
+	prunedIndex.resize(modes.data.rows());
+	for (size_t cm = 0; cm < modes.data.rows(); ++cm) {
+		std::pair<double, int> closest = findClosest(modes.data[cm], foomodes, config.metric);
 		prunedIndex[cm] = closest.second;
 	}
 
@@ -0,0 +1,178 @@
+#ifndef VPTREE_H
+#define VPTREE_H
+
+#include <opencv2/core.hpp> // for cv::RNG
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace seg_meanshift {
+
+/* vantage point tree for neighbor queries in FAMS, replacing scans over all points.
+ * Works with any metric on unsigned distances, given as Distance(a, b, bound) on rows.
+ * The distance may stop early at bound, then returning a value in [bound, distance].
+ * Queries are const and can run concurrently.
+ * Note: tapkee's VantagePointTree only does kNN, keeps search state in the tree
+ * and lacks per-point radii, so we roll our own. */
+template<typename Distance>
+class VPTree
+{
+public:
+	using Row = const unsigned short*;
+	// (point index, distance)
+	using Hit = std::pair<unsigned, unsigned>;
+
+	VPTree(std::vector<Row> rows, Distance distance)
+	    : rows(std::move(rows)), distance(distance)
+	{
+		if (this->rows.empty())
+			return;
+
+		std::vector<Hit> items(this->rows.size());
+		for (unsigned i = 0; i < items.size(); ++i)
+			items[i] = {i, 0};
+		cv::RNG rng(42); // reproducible trees
+		nodes.reserve(items.size());
+		build(items, 0, items.size(), rng);
+		windows.assign(this->rows.size(), 0);
+	}
+
+	/* set radius of influence of each point, used by withinWindows() */
+	void setWindows(std::vector<unsigned> source)
+	{
+		windows = std::move(source);
+		// children come after their parent, so go backwards to accumulate
+		for (auto i = nodes.size(); i > 0; --i) {
+			auto &n = nodes[i - 1];
+			n.maxWindow = windows[n.point];
+			if (n.inside)
+				n.maxWindow = std::max(n.maxWindow, nodes[n.inside].maxWindow);
+			if (n.outside)
+				n.maxWindow = std::max(n.maxWindow, nodes[n.outside].maxWindow);
+		}
+	}
+
+	/* distances to the k nearest points (counting a point at the query itself),
+	 * ascending; only points closer than limit are considered, the rest is filled
+	 * with limit */
+	void nearestDistances(Row query, size_t k, unsigned limit, unsigned *result) const
+	{
+		std::priority_queue<unsigned> heap; // largest on top
+		unsigned tau = limit;
+		if (!nodes.empty() && k > 0)
+			nearest(0, query, k, heap, tau);
+		std::fill(result + heap.size(), result + k, limit);
+		for (auto i = heap.size(); i > 0; --i) {
+			result[i - 1] = heap.top();
+			heap.pop();
+		}
+	}
+
+	/* all points i with distance(query, i) < window of i, in index order */
+	void withinWindows(Row query, std::vector<Hit> &result) const
+	{
+		result.clear();
+		if (!nodes.empty())
+			within(0, query, result);
+		std::sort(result.begin(), result.end());
+	}
+
+protected:
+	struct Node {
+		unsigned point;
+		// points in inside subtree are at most threshold away from point,
+		// points in outside subtree at least
+		unsigned threshold = 0;
+		// child nodes, 0 for none (root is never a child)
+		unsigned inside = 0, outside = 0;
+		// largest window in subtree
+		unsigned maxWindow = 0;
+	};
+
+	unsigned build(std::vector<Hit> &items, size_t lower, size_t upper, cv::RNG &rng)
+	{
+		auto index = (unsigned)nodes.size();
+		std::swap(items[lower], items[lower + (size_t)rng.uniform(0, (int)(upper - lower))]);
+		nodes.push_back({items[lower].first});
+		if (upper - lower < 2)
+			return index;
+
+		auto vantage = rows[items[lower].first];
+		for (auto i = lower + 1; i < upper; ++i)
+			items[i].second = distance(vantage, rows[items[i].first], unbounded);
+		auto median = (lower + 1 + upper) / 2;
+		std::nth_element(items.begin() + lower + 1, items.begin() + median, items.begin() + upper,
+		                 [] (const Hit &a, const Hit &b) { return a.second < b.second; });
+
+		// note: take care, nodes vector may be reallocated during recursion
+		nodes[index].threshold = items[median].second;
+		if (median > lower + 1) {
+			auto inside = build(items, lower + 1, median, rng);
+			nodes[index].inside = inside;
+		}
+		auto outside = build(items, median, upper, rng);
+		nodes[index].outside = outside;
+		return index;
+	}
+
+	void nearest(unsigned index, Row query, size_t k,
+	             std::priority_queue<unsigned> &heap, unsigned &tau) const
+	{
+		auto &n = nodes[index];
+		// beyond this, neither point nor inside subtree matter (tau only shrinks)
+		auto dist = distance(query, rows[n.point], saturate((uint64_t)n.threshold + std::max(tau, 1u)));
+		if (dist < tau) {
+			heap.push(dist);
+			if (heap.size() > k)
+				heap.pop();
+			if (heap.size() == k)
+				tau = heap.top();
+		}
+
+		// triangle inequality bounds distances in subtrees; note: tau shrinks
+		auto visitInside = [&] {
+			if (n.inside && (uint64_t)dist < (uint64_t)n.threshold + tau)
+				nearest(n.inside, query, k, heap, tau);
+		};
+		auto visitOutside = [&] {
+			if (n.outside && (uint64_t)n.threshold < (uint64_t)dist + tau)
+				nearest(n.outside, query, k, heap, tau);
+		};
+		if (dist < n.threshold) {
+			visitInside();
+			visitOutside();
+		} else {
+			visitOutside();
+			visitInside();
+		}
+	}
+
+	void within(unsigned index, Row query, std::vector<Hit> &result) const
+	{
+		auto &n = nodes[index];
+		// beyond this, neither point nor inside subtree matter
+		auto bound = std::max((uint64_t)windows[n.point], (uint64_t)n.threshold +
+		                      std::max(n.inside ? nodes[n.inside].maxWindow : 0u, 1u));
+		auto dist = distance(query, rows[n.point], saturate(bound));
+		if (dist < windows[n.point])
+			result.push_back({n.point, dist});
+
+		if (n.inside && (uint64_t)dist < (uint64_t)n.threshold + nodes[n.inside].maxWindow)
+			within(n.inside, query, result);
+		if (n.outside && (uint64_t)n.threshold < (uint64_t)dist + nodes[n.outside].maxWindow)
+			within(n.outside, query, result);
+	}
+
+	static constexpr unsigned unbounded = std::numeric_limits<unsigned>::max();
+	static unsigned saturate(uint64_t value) { return (unsigned)std::min(value, (uint64_t)unbounded); }
+
+	std::vector<Row> rows;
+	Distance distance;
+	std::vector<Node> nodes; // in pre-order, root first
+	std::vector<unsigned> windows;
+};
+
+}
+#endif
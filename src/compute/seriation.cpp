@@ -0,0 +1,139 @@
+#include "seriation.h"
+#include "distmat.h"
+#include "jobregistry.h"
+
+#include <tapkee/utils/arpack_wrapper.hpp> // includes Eigen
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <cmath>
+
+namespace seriation {
+
+using tapkee::DenseMatrix;
+using tapkee::DenseVector;
+using tapkee::SparseWeightMatrix;
+
+/* matrix-vector product for ARPACK; no factorization, so cost is linear in the edges */
+struct AdjacencyOperation {
+	AdjacencyOperation(const SparseWeightMatrix &matrix) : matrix(matrix) {}
+	DenseMatrix operator()(const DenseMatrix &operand) { return matrix * operand; }
+	const SparseWeightMatrix &matrix;
+};
+
+// below this size, a dense solver is faster and more robust
+static const Eigen::Index denseThreshold = 200;
+
+/* second largest eigenvector of normalized adjacency D^-1/2 W D^-1/2, which is the
+ * smallest non-trivial one of the normalized Laplacian; empty on failure */
+static DenseVector fiedler(const SparseWeightMatrix &adjacency)
+{
+	auto n = adjacency.rows();
+	if (n < denseThreshold) {
+		Eigen::SelfAdjointEigenSolver<DenseMatrix> solver{DenseMatrix(adjacency)};
+		if (solver.info() != Eigen::Success)
+			return {};
+		return solver.eigenvectors().col(n - 2); // eigenvalues are sorted ascending
+	}
+
+	// largest algebraic (not magnitude), as the spectrum reaches down to -1
+	ArpackGeneralizedSelfAdjointEigenSolver<SparseWeightMatrix, SparseWeightMatrix, AdjacencyOperation>
+	        solver(adjacency, 2, "LA", Eigen::ComputeEigenvectors, 1e-6);
+	if (solver.info() != Eigen::Success)
+		return {};
+	Eigen::Index smaller;
+	solver.eigenvalues().minCoeff(&smaller);
+	return solver.eigenvectors().col(smaller);
+}
+
+std::vector<unsigned> spectral(const Features::Matrix &features, size_t k)
+{
+	auto jr = JobRegistry::get();
+	auto n = (size_t)features.rows;
+	auto neighbors = distmat::computeNeighbors(features, k);
+	k = neighbors.k;
+	if (jr->isCurrentJobCancelled())
+		return {};
+	jr->setCurrentJobProgress(50.f);
+
+	/* heat kernel weights, width from mean squared neighbor distance */
+	double width = 0.;
+	for (auto d : neighbors.distance)
+		width += double(d) * d;
+	width = (width > 0. ? width / neighbors.distance.size() : 1.);
+	auto weight = [&] (size_t e) {
+		return std::exp(-double(neighbors.distance[e]) * neighbors.distance[e] / width);
+	};
+
+	/* connected components of the (symmetric) neighbor graph */
+	std::vector<unsigned> label(n);
+	std::iota(label.begin(), label.end(), 0);
+	auto find = [&label] (unsigned i) {
+		while (label[i] != i)
+			i = label[i] = label[label[i]]; // path halving
+		return i;
+	};
+	for (size_t i = 0; i < n; ++i) {
+		for (size_t j = 0; j < k; ++j) {
+			auto a = find((unsigned)i), b = find(neighbors.index[i * k + j]);
+			if (a != b)
+				label[std::max(a, b)] = std::min(a, b);
+		}
+	}
+	std::vector<std::vector<unsigned>> components(n);
+	for (size_t i = 0; i < n; ++i)
+		components[find((unsigned)i)].push_back((unsigned)i);
+	std::stable_sort(components.begin(), components.end(),
+	                 [] (const auto &a, const auto &b) { return a.size() > b.size(); });
+
+	std::vector<unsigned> ret;
+	ret.reserve(n);
+	std::vector<unsigned> local(n); // index within current component
+	for (auto &members : components) {
+		if (members.size() < 3) { // also stops at the empty tail
+			ret.insert(ret.end(), members.begin(), members.end());
+			continue;
+		}
+		if (jr->isCurrentJobCancelled())
+			return {};
+
+		/* normalized adjacency of component, symmetrized by max */
+		auto size = (Eigen::Index)members.size();
+		for (size_t i = 0; i < members.size(); ++i)
+			local[members[i]] = (unsigned)i;
+		std::vector<Eigen::Triplet<double>> triplets;
+		triplets.reserve(2 * members.size() * k);
+		for (auto i : members) {
+			for (size_t e = i * k; e < (i + 1) * k; ++e) {
+				auto a = (int)local[i], b = (int)local[neighbors.index[e]];
+				triplets.emplace_back(a, b, weight(e));
+				triplets.emplace_back(b, a, weight(e));
+			}
+		}
+		SparseWeightMatrix adjacency(size, size);
+		adjacency.setFromTriplets(triplets.begin(), triplets.end(),
+		                          [] (double a, double b) { return std::max(a, b); });
+		DenseVector scale = (adjacency * DenseVector::Ones(size)).cwiseSqrt().cwiseInverse();
+		for (Eigen::Index o = 0; o < adjacency.outerSize(); ++o) {
+			for (SparseWeightMatrix::InnerIterator it(adjacency, o); it; ++it)
+				it.valueRef() *= scale[it.row()] * scale[it.col()];
+		}
+
+		auto vector = fiedler(adjacency);
+		if (vector.size() == size) {
+			// back to random walk Laplacian; sign of the vector is arbitrary
+			DenseVector position = vector.cwiseProduct(scale);
+			std::stable_sort(members.begin(), members.end(), [&] (unsigned a, unsigned b) {
+				return position[local[a]] < position[local[b]];
+			});
+		} else {
+			std::cerr << "Spectral seriation of " << size << " items failed, keeping order" << std::endl;
+		}
+		ret.insert(ret.end(), members.begin(), members.end());
+		jr->setCurrentJobProgress(50.f + 50.f * float(ret.size()) / float(n));
+	}
+	return ret;
+}
+
+}
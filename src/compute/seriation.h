@@ -0,0 +1,17 @@
+#ifndef SERIATION_H
+#define SERIATION_H
+
+#include "model.h"
+
+#include <vector>
+
+namespace seriation {
+
+/* order rows along the Fiedler vector of their k-nearest-neighbor similarity graph;
+ * disconnected parts of the graph follow each other, largest first.
+ * Returns row indices, empty if cancelled */
+std::vector<unsigned> spectral(const Features::Matrix &features, size_t k = 10);
+
+}
+
+#endif // SERIATION_H
@@ -0,0 +1,87 @@
+#include "synthetic.h"
+#include "components.h"
+
+#include <QTextStream>
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace synthetic {
+
+Profiles generate(const Config &config)
+{
+	Profiles ret;
+	auto dims = std::max(config.dimensions, size_t(1));
+	// note: cv::RNG gives reproducible numbers, unlike std:: distributions
+	cv::RNG rng(config.seed);
+
+	/* profile shapes, as components of a gaussian mixture */
+	std::vector<Components> shapes(std::max(config.clusters, 1u));
+	for (auto &s : shapes) {
+		auto peaks = rng.uniform(1, (int)std::max(config.maxPeaks, 1u) + 1);
+		for (int i = 0; i < peaks; ++i) {
+			s.push_back({rng.uniform(.2, 1.), rng.uniform(0., (double)dims),
+			             rng.uniform(.5, std::max(1., dims / 10.))});
+		}
+	}
+
+	for (size_t d = 0; d < dims; ++d)
+		ret.dimensions << QString("F%1").arg(d + 1);
+
+	ret.features.create((int)config.proteins, (int)dims);
+	ret.scores.create(ret.features.size());
+	ret.labels.resize(config.proteins);
+	auto width = QString::number(config.proteins).size();
+	for (size_t p = 0; p < config.proteins; ++p) {
+		auto label = (unsigned)rng.uniform(0, (int)shapes.size());
+		ret.labels[p] = label;
+		ret.proteins << QString("SYN%1_HUMAN").arg(p + 1, width, 10, QChar('0'));
+
+		/* build profile from jittered shape */
+		std::vector<double> profile(dims, 0.);
+		auto shift = rng.gaussian(config.jitter * dims);
+		for (auto &c : shapes[label])
+			components::add_gauss(profile, c.mean + shift, c.sigma, c.weight);
+
+		auto max = *std::max_element(profile.begin(), profile.end());
+		auto f = ret.features[(int)p];
+		auto s = ret.scores[(int)p];
+		for (size_t d = 0; d < dims; ++d) {
+			auto v = (max > 0. ? profile[d] / max : 0.) + rng.gaussian(config.noise);
+			f[d] = std::clamp(v, 0., 1.);
+			// weak signal is less reliable
+			s[d] = std::abs(rng.gaussian(.05)) + .5 * (1. - f[d]) * rng.uniform(0., 1.);
+		}
+	}
+
+	return ret;
+}
+
+void write_simple(QTextStream &out, const Profiles &source)
+{
+	for (auto &d : source.dimensions)
+		out << "\t" << d;
+	out << "\n";
+	for (int p = 0; p < source.features.rows; ++p) {
+		out << source.proteins[p];
+		auto f = source.features[p];
+		for (int d = 0; d < source.features.cols; ++d)
+			out << "\t" << f[d];
+		out << "\n";
+	}
+}
+
+void write_long(QTextStream &out, const Profiles &source)
+{
+	out << "Protein\tPair\tDist\tScore\n";
+	for (int p = 0; p < source.features.rows; ++p) {
+		auto f = source.features[p];
+		auto s = source.scores[p];
+		for (int d = 0; d < source.features.cols; ++d) {
+			out << source.proteins[p] << "\t" << source.dimensions[d] << "\t"
+			    << f[d] << "\t" << s[d] << "\n";
+		}
+	}
+}
+
+}
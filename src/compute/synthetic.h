@@ -0,0 +1,42 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include "model.h"
+
+#include <QStringList>
+#include <vector>
+
+class QTextStream;
+
+/* generation of artificial protein profiles, e.g. for benchmarking and scale testing */
+namespace synthetic {
+
+struct Config {
+	size_t proteins = 1000;
+	size_t dimensions = 50;
+	unsigned clusters = 12; // number of distinct profile shapes
+	unsigned maxPeaks = 3; // each shape is a mixture of 1 to maxPeaks gaussians
+	double jitter = .02; // per-protein shift of peaks, relative to #dimensions
+	double noise = .02; // additive noise, relative to profile maximum
+	unsigned seed = 42;
+};
+
+struct Profiles {
+	QStringList dimensions;
+	QStringList proteins;
+	cv::Mat1d features; // normalized to [0, 1] per protein
+	cv::Mat1d scores; // lower is better, like in measured data
+	std::vector<unsigned> labels; // ground truth: cluster of each protein
+};
+
+// generate profiles; same config (incl. seed) yields same data on all platforms
+Profiles generate(const Config &config);
+
+// write in simple matrix format (blank first header field, one row per protein)
+void write_simple(QTextStream &out, const Profiles &source);
+// write in long format (columns Protein, Pair, Dist, Score; one row per value)
+void write_long(QTextStream &out, const Profiles &source);
+
+}
+
+#endif
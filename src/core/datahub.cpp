@@ -109,7 +109,8 @@ void DataHub::spawn(ConstDataPtr source, const DatasetConfiguration& config)
 		target->computeDisplay(initialDisplay);*/
 }
 
-void DataHub::importDataset(const QString &filename, const QString featureCol)
+void DataHub::importDataset(const QString &filename, const QString featureCol,
+                            Features::Precision precision)
 {
 	// TODO: using feature column name as normalize decision is a hack
 	Storage::ReadConfig readCfg{featureCol, featureCol.isEmpty() || featureCol == "Dist"};
@@ -132,6 +133,7 @@ void DataHub::importDataset(const QString &filename, const QString featureCol)
 	DatasetConfiguration config;
 	config.name = name;
 	config.normalized = readCfg.normalize;
+	config.precision = precision;
 
 	auto target = createDataset(config);
 	target->spawn(std::move(dataset));
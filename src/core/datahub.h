@@ -39,7 +39,8 @@ signals:
 public slots:
 	void updateProjectName(const QString &name, const QString &path);
 	void spawn(ConstDataPtr source, const DatasetConfiguration& config);
-	void importDataset(const QString &filename, const QString featureCol = {});
+	void importDataset(const QString &filename, const QString featureCol = {},
+	                   Features::Precision precision = Features::Precision::DOUBLE);
 	void removeDataset(unsigned id);
 	void openProject(const QString &filename);
 	bool saveProject(QString filename = {});
@@ -1,9 +1,11 @@
 #include "dataset.h"
+#include "jobregistry.h"
 #include "../compute/features.h"
 #include "../compute/dimred.h"
 #include "../compute/distmat.h"
 #include "../compute/annotations.h"
 #include "../compute/hierarchy.h"
+#include "../compute/seriation.h"
 
 #include <QDataStream>
 #include <QTextStream>
@@ -27,6 +29,65 @@ Dataset::~Dataset()
 	// needed for unique_ptr of incomplete type in header
 }
 
+QString Dataset::resource(Touch what) const
+{
+	return QString("dataset %1: %2").arg(conf.id).arg((int)what);
+}
+
+QString Dataset::resource(DistDirection direction, Distance dist) const
+{
+	return QString("dataset %1: distances %2/%3").arg(conf.id).arg((int)direction).arg((int)dist);
+}
+
+QString Dataset::requestKey(const Annotations::Meta &desc)
+{
+	// same criteria as annotations::equal()
+	if (desc.id > 0)
+		return QString("annotations %1").arg(desc.id);
+	auto ret = QString("annotations %1 %2").arg(desc.type).arg(desc.pruned);
+	if (desc.type == Annotations::Meta::MEANSHIFT)
+		ret += QString(" %1 %2").arg((double)desc.k, 0, 'g', 9).arg(desc.metric);
+	if (desc.type == Annotations::Meta::HIERCUT)
+		ret += QString(" %1 %2").arg(desc.hierarchy).arg(desc.granularity);
+	return ret;
+}
+
+QString Dataset::requestKey(const ::Order &desc)
+{
+	auto ret = QString("order %1").arg(desc.type);
+	if (auto a = std::get_if<Annotations::Meta>(&desc.source))
+		ret += ", " + requestKey(*a);
+	if (auto h = std::get_if<HrClustering::Meta>(&desc.source))
+		ret += QString(", hierarchy %1").arg(h->id);
+	return ret;
+}
+
+std::shared_ptr<bool> Dataset::claim(const QString &request)
+{
+	std::unique_lock lock(inflightLock);
+	for (auto it = inflight.find(request); it != inflight.end(); it = inflight.find(request)) {
+		/* somebody else computes the same, wait for it (unless we get cancelled) */
+		auto pending = it->second;
+		lock.unlock();
+		while (pending.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+			if (JobRegistry::isCurrentJobCancelled())
+				return {};
+		}
+		if (pending.get() || JobRegistry::isCurrentJobCancelled())
+			return {};
+		lock.lock(); // other run gave no result, try to take over
+	}
+
+	auto done = std::make_shared<std::promise<bool>>();
+	inflight[request] = done->get_future().share();
+	return {new bool(false), [this, request, done] (bool *stored) {
+		std::unique_lock lock(inflightLock);
+		inflight.erase(request);
+		done->set_value(*stored);
+		delete stored;
+	}};
+}
+
 template<>
 View<Dataset::Base> Dataset::peek() const { return View(b); }
 template<>
@@ -41,11 +102,12 @@ void Dataset::spawn(Features::Ptr base, std::unique_ptr<::Representations> repr)
 	b.dimensions = std::move(base->dimensions);
 	b.protIds = std::move(base->protIds);
 	b.protIndex = std::move(base->protIndex);
-	b.features = std::move(base->features);
 	b.featureRange = std::move(base->featureRange);
 	b.logSpace = std::move(base->logSpace);
-	b.scores = std::move(base->scores);
 	b.scoreRange = std::move(base->scoreRange);
+	// store in requested precision (no-op for double)
+	b.features = features::convert(base->features, conf.precision, b.featureRange);
+	b.scores = features::convert(base->scores, conf.precision, b.scoreRange);
 
 	if (repr)
 		r.displays = std::move(repr->displays);
@@ -76,11 +138,17 @@ void Dataset::spawn(ConstPtr srcholder)
 	b.protIds = bIn->protIds;
 
 	// only carry over features/scores we keep
-	auto fill_stripped = [this] (const auto &source, auto &target) {
-		target.resize(source.size(), std::vector<double>(conf.bands.size()));
-		tbb::parallel_for(size_t(0), target.size(), [&] (size_t i) {
-			for (size_t x = 0; x < conf.bands.size(); ++x)
-				target[i][x] = source[i][conf.bands[x]];
+	auto fill_stripped = [this] (const Features::Matrix &source, Features::Matrix &target) {
+		target = Features::Matrix(cv::Mat(source.rows, (int)conf.bands.size(), source.type()),
+		                          source.scale, source.offset);
+		features::visit(target, [&] (auto t) {
+			decltype(t) src(source);
+			tbb::parallel_for(0, t.rows, [&] (int i) {
+				auto in = src[i];
+				auto out = t[i];
+				for (size_t x = 0; x < conf.bands.size(); ++x)
+					out[x] = in[conf.bands[x]];
+			});
 		});
 	};
 
@@ -101,6 +169,10 @@ void Dataset::spawn(ConstPtr srcholder)
 		b.featureRange = features::range_of(b.features);
 	}
 
+	/* store in requested precision, if it differs from source */
+	b.features = features::convert(b.features, conf.precision, b.featureRange);
+	b.scores = features::convert(b.scores, conf.precision, b.scoreRange);
+
 	b.featurePoints = features::pointify(b.features);
 
 	auto sIn = srcholder->peek<Structure>();
@@ -116,6 +188,9 @@ void Dataset::computeDisplay(const QString& request)
 	 * In case we actually do lock base for write in the future, we should copy data instead;
 	 * Note that a pending write lock will eventually block GUI when it also tries to read,
 	 * so write should never have to wait for too long. */
+	auto token = claim(QString("display %1").arg(request));
+	if (!token)
+		return; // was computed concurrently
 	auto result = dimred::compute(request, peek<Base>()->features);
 
 	r.l.lockForWrite();
@@ -124,6 +199,7 @@ void Dataset::computeDisplay(const QString& request)
 		// TODO: lookup in datasets[d->conf->parent].displays and perform rigid registration
 	}
 	r.l.unlock();
+	*token = true;
 
 	emit update(Touch::DISPLAY);
 }
@@ -141,8 +217,11 @@ void Dataset::computeDistances(DistDirection direction, Distance dist)
 {
 	if (peek<Representations>()->distances.at(direction).count(dist))
 		return; // already there
+	auto token = claim(resource(direction, dist));
+	if (!token || peek<Representations>()->distances.at(direction).count(dist))
+		return; // was computed concurrently
 
-	cv::Mat1f result;
+	SymmetricMatrix result;
 	switch (direction) {
 	case DistDirection::PER_PROTEIN:
 		result = distmat::computeMatrix(peek<Base>()->features, dist);
@@ -150,43 +229,48 @@ void Dataset::computeDistances(DistDirection direction, Distance dist)
 	case DistDirection::PER_DIMENSION:
 		auto d = peek<Base>();
 		// re-arrange data to obtain per-dimension feature vectors
-		std::vector<std::vector<double>>
-		        features((size_t)d->dimensions.size(), std::vector<double>(d->features.size()));
-		for (size_t i = 0; i < d->features.size(); ++i) {
-			for (size_t j = 0; j < d->features[i].size(); ++j) {
-				features[j][i] = d->features[i][j];
-			}
-		}
+		Features::Matrix features(cv::Mat(d->features.t()), d->features.scale, d->features.offset);
 		d.unlock();
 		result = distmat::computeMatrix(features, dist);
 	}
 
 	r.l.lockForWrite();
-	r.distances[direction][dist] = result;
+	r.distances[direction][dist] = std::move(result);
 	r.l.unlock();
+	*token = true;
 
 	emit update(Touch::DISTANCES);
 }
 
-void Dataset::computeHierarchy()
+void Dataset::computeHierarchy(Linkage linkage)
 {
-	auto distance = Distance::COSINE;
-	computeDistances(DistDirection::PER_PROTEIN, distance); // ensure availability
+	auto token = claim(QString("hierarchy %1").arg((int)linkage));
+	if (!token)
+		return; // was computed concurrently
+	computeDistances(DistDirection::PER_PROTEIN, hierarchyDistance); // ensure availability
 	auto h = hierarchy::agglomerative(
-	             peek<Representations>()->distances.at(DistDirection::PER_PROTEIN).at(distance),
-	             peek<Base>()->protIds);
+	             peek<Representations>()->distances.at(DistDirection::PER_PROTEIN).at(hierarchyDistance),
+	             peek<Base>()->protIds, linkage);
 	if (!h) // empty result when operation was cancelled
 		return;
 
 	h->meta.dataset = conf.id;
 	h->meta.name = QString{"Hierarchy on %1"}.arg(conf.name);
+	std::map<Linkage, QString> linkageNames = {
+	    {Linkage::SINGLE, "single"}, {Linkage::COMPLETE, "complete"}, {Linkage::WARD, "Ward"}};
+	if (linkageNames.count(linkage)) // average linkage is our default, no need to mention
+		h->meta.name += QString{" (%1 linkage)"}.arg(linkageNames.at(linkage));
 	proteins.addHierarchy(std::move(h), true); // selects
+	*token = true;
 }
 
 void Dataset::computeAnnotations(const Annotations::Meta &desc)
 {
 	if (peek<Structure>()->fetch(desc))
 		return; // already there
+	auto token = claim(requestKey(desc));
+	if (!token || peek<Structure>()->fetch(desc))
+		return; // was computed concurrently
 
 	Touched touched;
 
@@ -198,7 +282,7 @@ void Dataset::computeAnnotations(const Annotations::Meta &desc)
 	} else {
 		/* special case: meanshift */
 		if (desc.type == Annotations::Meta::MEANSHIFT) {
-			auto src = computeFAMS(desc.k, desc.pruned);
+			auto src = computeFAMS(desc.k, desc.metric, desc.pruned);
 			if (!src.groups.empty())
 				touched |= storeAnnotations(src, true);
 		}
@@ -209,6 +293,7 @@ void Dataset::computeAnnotations(const Annotations::Meta &desc)
 			touched |= storeAnnotations(src, false);
 		}
 	}
+	*token = (peek<Structure>()->fetch(desc) != nullptr);
 
 	emit update(touched);
 }
@@ -217,25 +302,88 @@ void Dataset::computeOrder(const ::Order &desc)
 {
 	if (peek<Structure>()->fetch(desc).type == desc.type) // didn't fall back
 		return; // already there
+	auto token = claim(requestKey(desc));
+	if (!token || peek<Structure>()->fetch(desc).type == desc.type)
+		return; // was computed concurrently
+
+	/* optimal leaf ordering and seriation are expensive, so we do it before locking */
+	std::vector<unsigned> precomputed;
+	if (desc.type == Order::SPECTRAL) {
+		precomputed = seriation::spectral(peek<Base>()->features);
+		if (precomputed.empty()) // cancelled
+			return;
+	}
+	if (desc.type == Order::HIERARCHY_OPTIMAL) {
+		computeDistances(DistDirection::PER_PROTEIN, hierarchyDistance); // ensure availability
+		/* work on copies, so writers of proteins and dataset are not blocked meanwhile;
+		 * the distance matrix copy is shallow */
+		HrClustering tree;
+		{
+			auto p = peek<Proteins>();
+			auto id = std::get_if<HrClustering::Meta>(&desc.source)->id; // Apple no std::get
+			if (!p->structures.count(id))
+				return;
+			tree = *std::get_if<HrClustering>(&p->structures.at(id)); // Apple no std::get
+		}
+		auto distances = peek<Representations>()->distances.at(DistDirection::PER_PROTEIN)
+		                 .at(hierarchyDistance);
+		auto protIndex = peek<Base>()->protIndex;
+		precomputed = hierarchy::optimalLeafOrder(tree, distances, protIndex);
+		if (precomputed.empty()) // cancelled, or no proteins covered
+			return;
+	}
 
 	s.l.lockForWrite();
-	calculateOrder(desc);
+	calculateOrder(desc, precomputed);
 	s.l.unlock();
+	*token = true;
 	emit update(Touch::ORDER);
 }
 
-Annotations Dataset::computeFAMS(float k, bool prune)
+void Dataset::speculateFAMS(std::vector<float> grid, Annotations::Meta::Metric metric, bool prune)
+{
+	if (speculating.test_and_set())
+		return;
+
+	/* keep the machine for regular work: the background arena only gets spare threads.
+	 * Note: we do not lower thread priority, as our thread is shared (pool) */
+
+	// largest k first, its pilot covers the others (see FAMS::PilotCache)
+	std::sort(grid.rbegin(), grid.rend());
+	for (auto k : grid) {
+		Annotations::Meta desc{Annotations::Meta::MEANSHIFT};
+		desc.k = k;
+		desc.metric = metric;
+		desc.pruned = prune;
+		if (peek<Structure>()->fetch(desc))
+			continue;
+
+		::Annotations src;
+		JobRegistry::execute(Task::Priority::BACKGROUND,
+		                     [&] { src = computeFAMS(k, metric, prune, true); });
+		if (src.groups.empty()) // cancelled, or gave way to a regular run
+			break;
+		emit update(storeAnnotations(src, true));
+	}
+
+	speculating.clear();
+}
+
+Annotations Dataset::computeFAMS(float k, Annotations::Meta::Metric metric, bool prune,
+                                 bool speculative)
 {
 	if (!meanshift) {
 		/* we guard meanshift init with write on structure lock (hack);
 		 * don't attempt to lock base for write; see computeDisplay() for the reason why */
 		s.l.lockForWrite();
-		if (!meanshift)
-			meanshift = std::make_unique<annotations::Meanshift>(peek<Base>()->features);
+		if (!meanshift) {
+			auto b = peek<Base>();
+			meanshift = std::make_unique<annotations::Meanshift>(b->features, b->featureRange);
+		}
 		s.l.unlock();
 	}
 
-	auto result = meanshift->run(k);
+	auto result = meanshift->run(k, metric, speculative);
 	if (!result)
 		return {};
 
@@ -244,13 +392,20 @@ Annotations Dataset::computeFAMS(float k, bool prune)
 	::Annotations ret;
 	ret.meta = {Annotations::Meta::MEANSHIFT};
 	ret.meta.name = QString("Mean Shift, k=%1").arg((double)k, 0, 'f', 2);
+	std::map<Annotations::Meta::Metric, QString> metricNames = {
+	    {Annotations::Meta::L2, "L2"}, {Annotations::Meta::L2_NORMALIZED, "normalized L2"}};
+	if (metricNames.count(metric)) // L1 is our default, no need to mention
+		ret.meta.name += QString{" (%1)"}.arg(metricNames.at(metric));
 	ret.meta.dataset = conf.id;
 	ret.meta.k = k;
+	ret.meta.metric = metric;
 	ret.meta.pruned = prune;
 
 	auto d = peek<Base>();
-	for (unsigned i = 0; i < result->modes.size(); ++i)
-		ret.groups[i] = {QString("Cluster #%1").arg(i+1), {}, {}, result->modes[i]};
+	auto &modes = result->modes;
+	for (int i = 0; i < modes.rows; ++i)
+		ret.groups[(unsigned)i] = {QString("Cluster #%1").arg(i+1), {}, {},
+		                           std::vector<double>(modes[i], modes[i] + modes.cols)};
 
 	for (unsigned i = 0; i < result->associations.size(); ++i) {
 		auto m = (unsigned)result->associations[i];
@@ -267,8 +422,11 @@ Annotations Dataset::computeFAMS(float k, bool prune)
 
 Annotations Dataset::createPartition(unsigned id, unsigned granularity, bool prune)
 {
-	auto hierarchy = *std::get_if<HrClustering>(&proteins.peek()->structures.at(id)); // Apple no std::get
-	auto ret = hierarchy::partition(hierarchy, granularity);
+	auto ret = [&] {
+		auto p = proteins.peek(); // cheap enough to not copy the hierarchy
+		auto hierarchy = std::get_if<HrClustering>(&p->structures.at(id)); // Apple no std::get
+		return hierarchy::partition(*hierarchy, granularity);
+	}();
 	// ret.meta is initialized by hierarchy::partition (except pruning)
 	ret.meta.pruned = prune;
 
@@ -316,7 +474,8 @@ void Dataset::computeCentroids(Annotations &target)
 
 	for (unsigned i = 0; i < target.memberships.size(); ++i) {
 		for (auto ci : target.memberships[i]) {
-			cv::add(target.groups[ci].mode, d->features[i], target.groups[ci].mode);
+			auto &mode = target.groups[ci].mode;
+			cv::addWeighted(mode, 1., d->features.row((int)i), d->features.scale, 0., mode, CV_64F);
 			effective_sizes[ci]++;
 		}
 	}
@@ -324,11 +483,13 @@ void Dataset::computeCentroids(Annotations &target)
 	for (auto& [i, g] : target.groups) {
 		auto scale = 1./effective_sizes[i];
 		auto &m = g.mode;
-		std::for_each(m.begin(), m.end(), [scale] (double &e) { e *= scale; });
+		std::for_each(m.begin(), m.end(), [scale,o=d->features.offset] (double &e) {
+			e = e * scale + o;
+		});
 	}
 }
 
-void Dataset::calculateOrder(const ::Order &desc)
+void Dataset::calculateOrder(const ::Order &desc, const std::vector<unsigned> &precomputed)
 {
 	/* Note: caller has locked s for us for writing */
 
@@ -341,6 +502,7 @@ void Dataset::calculateOrder(const ::Order &desc)
 	switch (desc.type) {
 	case Order::FILE:	target = &s.fileOrder; break;
 	case Order::NAME:	target = &s.nameOrder; break;
+	case Order::SPECTRAL:	target = &s.orders.emplace(0, Order{desc})->second; break;
 	case Order::CLUSTERING:
 		asource = s.fetch(*std::get_if<Annotations::Meta>(&desc.source)); // Apple no std::get
 		if (!asource)
@@ -348,6 +510,7 @@ void Dataset::calculateOrder(const ::Order &desc)
 		target = &s.orders.emplace(asource->meta.id, Order{desc})->second;
 		break;
 	case Order::HIERARCHY:
+	case Order::HIERARCHY_OPTIMAL:
 		sourceid = std::get_if<HrClustering::Meta>(&desc.source)->id; // Apple no std::get
 		if (!p->structures.count(sourceid))
 			return;
@@ -396,6 +559,13 @@ void Dataset::calculateOrder(const ::Order &desc)
 		addUnseen(seen);
 		break;
 	}
+	/* order based on hierarchy, with least distances between neighbors, or on seriation */
+	case Order::HIERARCHY_OPTIMAL:
+	case Order::SPECTRAL:
+		index = precomputed;
+		// add all proteins not covered yet
+		addUnseen(std::unordered_set<unsigned>(index.begin(), index.end()));
+		break;
 	/* order based on ordered clusters */
 	case Order::CLUSTERING: {
 		// ensure that each protein appears only once
@@ -407,7 +577,7 @@ void Dataset::calculateOrder(const ::Order &desc)
 				if (seen.count(i))
 					continue; // protein was part of bigger cluster
 				if (asource->memberships[i].count(ci)) {
-					double dist = cv::norm(d->features[i],
+					double dist = cv::norm(features::row_of(d->features, (int)i),
 					                       asource->groups.at(ci).mode,
 					                       cv::NORM_L2SQR);
 					members.push_back({i, dist});
@@ -485,11 +655,16 @@ const Dataset::Order& Dataset::Structure::fetch(::Order desc) const
 	unsigned key = 0;
 	if (desc.type == Order::CLUSTERING)
 		key = std::get_if<Annotations::Meta>(&desc.source)->id; // Apple no std::get
-	if (desc.type == Order::HIERARCHY)
+	if (desc.type == Order::HIERARCHY || desc.type == Order::HIERARCHY_OPTIMAL)
 		key = std::get_if<HrClustering::Meta>(&desc.source)->id; // Apple no std::get
 	if (key > 0) {
-		auto it = orders.find(key);
-		return (it == orders.end() ? nameOrder : it->second);
+		// a hierarchy may provide several orders
+		auto candidates = orders.equal_range(key);
+		for (auto it = candidates.first; it != candidates.second; ++it) {
+			if (it->second.type == desc.type)
+				return it->second;
+		}
+		return nameOrder;
 	}
 
 	/* try to find for internal annotation */
@@ -502,7 +677,7 @@ const Dataset::Order& Dataset::Structure::fetch(::Order desc) const
 			auto b = std::get_if<Annotations::Meta>(&it->second.source); // Apple no std::get
 			if (a->type != b->type)
 				continue;
-			if (a->type == Annotations::Meta::MEANSHIFT && a->k != b->k)
+			if (a->type == Annotations::Meta::MEANSHIFT && (a->k != b->k || a->metric != b->metric))
 				continue;
 			if (a->type == Annotations::Meta::HIERCUT &&
 			    (a->hierarchy != b->hierarchy || a->granularity != b->granularity))
@@ -13,6 +13,9 @@
 #include <set>
 #include <map>
 #include <memory>
+#include <atomic>
+#include <mutex>
+#include <future>
 
 namespace annotations {	class Meanshift; }
 class QTextStream;
@@ -25,6 +28,7 @@ struct DatasetConfiguration {
 	bool normalized = false; // true if data was normalized to [0, 1] range
 	std::vector<unsigned> bands; // the feature bands that were kept
 	double scoreThresh = 0.; // score cutoff that was applied
+	Features::Precision precision = Features::Precision::DOUBLE; // storage of features/scores
 };
 Q_DECLARE_METATYPE(DatasetConfiguration)
 
@@ -91,6 +95,9 @@ public:
 	~Dataset();
 	const DatasetConfiguration& config() const { return conf; }
 	unsigned id() const { return conf.id; }
+	// names of results, for dependencies between tasks (see Task::needs)
+	QString resource(Touch what) const;
+	QString resource(DistDirection direction, Distance dist) const;
 	void setName(const QString &name) { conf.name = name; }
 
 	template<typename T>
@@ -102,8 +109,12 @@ public:
 	void computeDisplay(const QString &name);
 	void addDisplay(const QString &name, const Representations::Pointset &points);
 	void computeDistances(DistDirection dir, Distance dist);
-	void computeHierarchy();
+	void computeHierarchy(Linkage linkage = Linkage::AVERAGE);
+	// distance used by computeHierarchy() and optimal leaf ordering
+	static constexpr Distance hierarchyDistance = Distance::COSINE;
 	void computeAnnotations(const Annotations::Meta &desc);
+	// mean shift for several k in advance, until a regular run interferes
+	void speculateFAMS(std::vector<float> grid, Annotations::Meta::Metric metric, bool prune);
 	void computeOrder(const ::Order &desc);
 
 signals:
@@ -111,10 +122,19 @@ signals:
 
 protected:
 	Touched storeAnnotations(const ::Annotations &source, bool withOrder);
-	::Annotations computeFAMS(float k, bool prune);
+	::Annotations computeFAMS(float k, Annotations::Meta::Metric metric, bool prune,
+	                          bool speculative = false);
 	::Annotations createPartition(unsigned id, unsigned granularity, bool prune);
-	void calculateOrder(const ::Order &desc);
+	// precomputed: index for HIERARCHY_OPTIMAL and SPECTRAL, see computeOrder()
+	void calculateOrder(const ::Order &desc, const std::vector<unsigned> &precomputed = {});
 	void computeCentroids(Annotations &target);
+	/* claim a request (by key) for computation, released when the token is destroyed.
+	 * Set *token once the result is stored. If an identical request is in flight, waits
+	 * for it and returns empty, as the caller has nothing to do. If that run ended without
+	 * result (e.g. cancelled), the caller takes over instead, unless cancelled itself. */
+	std::shared_ptr<bool> claim(const QString &request);
+	static QString requestKey(const Annotations::Meta &desc);
+	static QString requestKey(const ::Order &desc);
 
 	// meta information for this dataset
 	DatasetConfiguration conf;
@@ -124,8 +144,13 @@ protected:
 	Representations r;
 	Structure s;
 
-	// our meanshift worker. if set, holds a copy of features
+	// our meanshift worker. if set, holds copies of features
 	std::unique_ptr<annotations::Meanshift> meanshift;
+	// only one speculateFAMS() at a time
+	std::atomic_flag speculating = ATOMIC_FLAG_INIT;
+	// computations in progress, by request key, see claim()
+	std::map<QString, std::shared_future<bool>> inflight; // true if result was stored
+	std::mutex inflightLock;
 
 	ProteinDB &proteins;
 };
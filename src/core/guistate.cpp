@@ -57,6 +57,11 @@ GuiState::GuiState(DataHub &hub)
 	});
 	connect(&hub, &DataHub::newDataset, this, &GuiState::addDataset);
 	connect(&hub, &DataHub::datasetRemoved, this, &GuiState::removeDataset);
+
+	/* jobs report progress without notification; pass it on to monitors at a steady rate */
+	auto progressSampler = new QTimer(this);
+	connect(progressSampler, &QTimer::timeout, [] { JobRegistry::get()->sampleProgress(); });
+	progressSampler->start(1000 / 10);
 }
 
 GuiState::~GuiState()
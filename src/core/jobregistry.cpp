@@ -3,6 +3,42 @@
 #include <QThread>
 #include <QMetaObject>
 #include <QtConcurrent>
+#include <QThreadPool>
+
+#include <tbb/task_arena.h>
+
+// slot of the job running in this thread, see startCurrentJob()
+static thread_local std::shared_ptr<JobRegistry::Slot> currentSlot;
+
+// worker threads per priority class, see setConcurrency()
+static std::atomic<int> concurrency[] = {
+    tbb::task_arena::automatic, tbb::task_arena::automatic, tbb::task_arena::automatic};
+
+static tbb::task_arena& arena(Task::Priority priority)
+{
+	/* each thread that may run jobs (the pool, plus the GUI thread) has a slot reserved, so
+	 * execute() never hands a job body to a TBB worker. Workers only take parallel work. */
+	static const int masters = QThreadPool::globalInstance()->maxThreadCount() + 1;
+	auto size = [] (Task::Priority p) {
+		int workers = concurrency[(int)p];
+		return masters + (workers == tbb::task_arena::automatic ? QThread::idealThreadCount() : workers);
+	};
+	using P = Task::Priority;
+	// note: arenas are initialized lazily by TBB, on first execute()
+#if TBB_INTERFACE_VERSION >= 12000
+	using TP = tbb::task_arena::priority;
+	static tbb::task_arena arenas[] = {
+	    {size(P::INTERACTIVE), (unsigned)masters, TP::high},
+	    {size(P::NORMAL), (unsigned)masters, TP::normal},
+	    {size(P::BACKGROUND), (unsigned)masters, TP::low}};
+#else // no arena priorities before oneTBB, still keep the classes apart
+	static tbb::task_arena arenas[] = {
+	    {size(P::INTERACTIVE), (unsigned)masters},
+	    {size(P::NORMAL), (unsigned)masters},
+	    {size(P::BACKGROUND), (unsigned)masters}};
+#endif
+	return arenas[(int)priority];
+}
 
 std::shared_ptr<JobRegistry> JobRegistry::get()
 {
@@ -10,31 +46,107 @@ std::shared_ptr<JobRegistry> JobRegistry::get()
 	return instance;
 }
 
+struct JobRegistry::Node {
+	Task task;
+	std::vector<QPointer<QObject>> monitors;
+	unsigned blockers = 0; // unfinished tasks we wait for
+	std::vector<std::shared_ptr<Node>> dependents;
+};
+
 void JobRegistry::run(const Task &task, const std::vector<QPointer<QObject>> &monitors)
 {
-	pipeline({task}, monitors);
+	get()->schedule({task}, monitors, false);
+}
+
+void JobRegistry::run(const std::vector<Task> &tasks, const std::vector<QPointer<QObject>> &monitors)
+{
+	get()->schedule(tasks, monitors, false);
 }
 
 void JobRegistry::pipeline(const std::vector<Task> &tasks,
                            const std::vector<QPointer<QObject>> &monitors)
 {
-	QtConcurrent::run([tasks,monitors] {
-		auto reg = JobRegistry::get();
+	get()->schedule(tasks, monitors, true);
+}
+
+void JobRegistry::schedule(const std::vector<Task> &tasks,
+                           const std::vector<QPointer<QObject>> &monitors, bool chained)
+{
+	std::vector<std::shared_ptr<Node>> ready;
+	{
+		std::scoped_lock _(scheduleLock);
+		std::shared_ptr<Node> previous;
 		for (auto &task : tasks) {
-			reg->startCurrentJob(task.type, task.fields, task.userData);
-			for (auto i : monitors)
-				reg->addCurrentJobMonitor(i);
-			task.fun();
-			reg->endCurrentJob();
+			auto node = std::make_shared<Node>(Node{task, monitors});
+			auto waitFor = [&node] (const std::shared_ptr<Node> &other) {
+				other->dependents.push_back(node);
+				node->blockers++;
+			};
+			if (chained && previous)
+				waitFor(previous);
+			for (auto &need : task.needs) {
+				auto range = providers.equal_range(need);
+				for (auto it = range.first; it != range.second; ++it)
+					waitFor(it->second);
+			}
+			for (auto &result : task.provides)
+				providers.insert({result, node});
+			if (!node->blockers)
+				ready.push_back(node);
+			previous = node;
 		}
+	}
+	// note: nothing can finish before we launch, so it is fine to do it outside the lock
+	for (auto &node : ready)
+		launch(node);
+}
+
+void JobRegistry::launch(std::shared_ptr<Node> node)
+{
+	QtConcurrent::run([node] {
+		auto reg = JobRegistry::get();
+		reg->startCurrentJob(node->task.type, node->task.fields, node->task.userData);
+		for (auto i : node->monitors)
+			reg->addCurrentJobMonitor(i);
+		execute(node->task.priority, node->task.fun);
+		reg->endCurrentJob();
+		reg->finish(node);
 	});
 }
 
+void JobRegistry::finish(const std::shared_ptr<Node> &node)
+{
+	std::vector<std::shared_ptr<Node>> ready;
+	{
+		std::scoped_lock _(scheduleLock);
+		for (auto &result : node->task.provides) {
+			auto range = providers.equal_range(result);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second == node) {
+					providers.erase(it);
+					break;
+				}
+			}
+		}
+		for (auto &dependent : node->dependents) {
+			if (--dependent->blockers == 0)
+				ready.push_back(dependent);
+		}
+		node->dependents.clear();
+	}
+	for (auto &dependent : ready)
+		launch(dependent);
+}
+
 JobRegistry::Entry JobRegistry::job(unsigned id)
 {
 	QReadLocker _(&lock);
 	auto it = idToEntry(id);
-	return (it != jobs.end() ? it->second : Entry{});
+	if (it == jobs.end())
+		return {};
+	auto ret = it->second;
+	ret.progress = ret.slot->progress; // most recent
+	return ret;
 }
 
 void JobRegistry::cancelJob(unsigned id)
@@ -43,17 +155,30 @@ void JobRegistry::cancelJob(unsigned id)
 	auto it = idToEntry(id);
 	if (it != jobs.end()) {
 		it->second.isCancelled = true;
+		it->second.slot->cancelled = true;
 		notifyMonitors(id, "updateJob");
 	}
 }
 
 void JobRegistry::setJobProgress(unsigned id, float progress)
 {
-	QWriteLocker _(&lock);
+	QReadLocker _(&lock);
 	auto it = idToEntry(id);
 	if (it == jobs.end())
 		return; // TODO complain
-	updateProgress(it, progress);
+	it->second.slot->progress = progress;
+}
+
+void JobRegistry::sampleProgress()
+{
+	QWriteLocker _(&lock);
+	for (auto &[thread, entry] : jobs) {
+		float progress = entry.slot->progress;
+		if (progress == entry.progress)
+			continue;
+		entry.progress = progress;
+		notifyMonitors(entry.id, "updateJob");
+	}
 }
 
 JobRegistry::Entry JobRegistry::getCurrentJob()
@@ -63,12 +188,15 @@ JobRegistry::Entry JobRegistry::getCurrentJob()
 	return (it != jobs.end() ? it->second : Entry{});
 }
 
+std::shared_ptr<JobRegistry::Slot> JobRegistry::getCurrentSlot()
+{
+	return currentSlot;
+}
+
 bool JobRegistry::isCurrentJobCancelled()
 {
-	QReadLocker _(&lock);
-	auto it = threadToEntry();
-	if (it != jobs.end())
-		return it->second.isCancelled;
+	if (currentSlot)
+		return currentSlot->cancelled;
 	// TODO complain else
 	return false;
 }
@@ -102,10 +230,8 @@ void JobRegistry::addCurrentJobMonitor(QPointer<QObject> monitor)
 
 void JobRegistry::setCurrentJobProgress(float progress)
 {
-	QWriteLocker _(&lock);
-	auto it = threadToEntry();
-	if (it != jobs.end())
-		updateProgress(it, progress);
+	if (currentSlot)
+		currentSlot->progress = progress;
 	// TODO complain else
 }
 
@@ -116,6 +242,20 @@ void JobRegistry::endCurrentJob()
 	if (it != jobs.end())
 		erase(it);
 	// TODO complain else
+	currentSlot.reset();
+}
+
+void JobRegistry::execute(Task::Priority priority, const std::function<void()> &fun)
+{
+	arena(priority).execute([&] {
+		// while waiting on our parallel work, do not pick up that of other jobs
+		tbb::this_task_arena::isolate(fun);
+	});
+}
+
+void JobRegistry::setConcurrency(Task::Priority priority, int threads)
+{
+	concurrency[(int)priority] = std::max(0, threads);
 }
 
 JobRegistry::JobMap::iterator JobRegistry::idToEntry(unsigned id)
@@ -140,6 +280,7 @@ void JobRegistry::createEntry(Task::Type type, const std::vector<QString> &field
 	    {T::GENERIC, "Background computation running"},
 	    {T::COMPUTE, "Computing %1 on %2"},
 	    {T::COMPUTE_FAMS, "Computing Mean Shift with k=%1 on %2"},
+	    {T::SPECULATE_FAMS, "Precomputing Mean Shift with k=%1 on %2"},
 	    {T::COMPUTE_HIERARCHY, "Computing hierarchy on %1"},
 	    {T::PARTITION_HIERARCHY, "Partitioning %1 on %2"},
 	    {T::ORDER, "Ordering %2 based on %1"},
@@ -163,7 +304,8 @@ void JobRegistry::createEntry(Task::Type type, const std::vector<QString> &field
 	for (auto i : fields)
 		name = name.arg(i);
 	// TODO: check for nullptr & complain
-	jobs[QThread::currentThread()] = {id, name, userData};
+	currentSlot = std::make_shared<Slot>();
+	jobs[QThread::currentThread()] = {id, name, userData, 0.f, false, currentSlot};
 }
 
 void JobRegistry::erase(JobMap::iterator entry)
@@ -177,13 +319,6 @@ void JobRegistry::erase(JobMap::iterator entry)
 	monitors.erase(jobId);
 }
 
-void JobRegistry::updateProgress(JobMap::iterator entry, float progress)
-{
-	// caller needs to hold lock
-	entry->second.progress = progress;
-	notifyMonitors(entry->second.id, "updateJob");
-}
-
 void JobRegistry::notifyMonitors(unsigned jobId, const char *signal)
 {
 	auto range = monitors.equal_range(jobId);
@@ -8,7 +8,10 @@
 #include <QPointer>
 #include <QVariant>
 #include <unordered_map>
+#include <map>
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 class QThread;
 
@@ -16,12 +19,19 @@ class QThread;
  * @brief A background task description
  * This struct is used to annotate a function to be run in the background with its type and
  * additional textual information. Use it when calling JobRegistry::run(), JobRegistry::pipeline().
+ *
+ * Dependencies are declared by names of results (see e.g. Dataset::resource()). A task waits for
+ * all scheduled or running tasks that provide something it needs. A task that needs something
+ * nobody is working on does not wait; it is expected to compute what is missing itself.
+ *
+ * The priority class decides the TBB arena the task runs in, see JobRegistry::execute().
  */
 struct Task {
 	enum class Type {
 		GENERIC,
 		COMPUTE,
 		COMPUTE_FAMS,
+		SPECULATE_FAMS,
 		COMPUTE_HIERARCHY,
 		PARTITION_HIERARCHY,
 		ANNOTATE,
@@ -39,10 +49,19 @@ struct Task {
 		SAVE,
 	};
 
+	enum class Priority {
+		INTERACTIVE, // the GUI waits for it, e.g. cursor-driven computations
+		NORMAL,
+		BACKGROUND, // bulk or speculative work, gets the cores nobody else needs
+	};
+
 	std::function<void()> fun;
 	Type type = Type::GENERIC;
 	std::vector<QString> fields = {};
 	QVariant userData = {};
+	std::vector<QString> needs = {};
+	std::vector<QString> provides = {};
+	Priority priority = Priority::NORMAL;
 };
 
 /**
@@ -54,56 +73,85 @@ struct Task {
  * This is a singleton so it can be accessible from everywhere. It is application-global just like
  * threads are.
  *
- * Progress updates and cancellation mechanics will be added later, and they rely on the caller to
- * call from the respective thread or provide the correct job id that was obtained by the respective
- * thread's call to getCurrentJob() after startCurrentJob().
+ * Progress and cancellation of each job live in a Slot of atomics, so computations report
+ * without taking any locks. setCurrentJobProgress() and isCurrentJobCancelled() work on the
+ * calling thread's job; workers in other threads (e.g. TBB) hold on to getCurrentSlot().
  *
  * Monitors are QObjects with slots addJob(unsigned), updateJob(unsigned), and removeJob(unsigned).
  * These methods are invoked so they will run in the QObject's thread. A monitor need not to
- * survive until the job ends, due to QPointer mechanics.
+ * survive until the job ends, due to QPointer mechanics. Progress changes are not pushed; they
+ * reach monitors through sampleProgress(), which the GUI calls at a fixed rate.
  *
  * The methods run() and pipeline() use QtConcurrent to run a function (or several) in
  * the background as well as registering it/them with us, and adding any monitors.
- * The pipeline is stupid; it just runs one job after another in the same thread.
+ * Tasks are started as soon as the tasks they depend on (see Task::needs) have finished, so
+ * independent tasks run concurrently. A pipeline additionally runs its tasks one after another.
+ * Note that waiting tasks are not registered as jobs yet, so monitors only see them once started.
  */
 class JobRegistry : public NonCopyable
 {
 public:
+	/* progress and cancellation of a job, shared with the computation */
+	struct Slot {
+		std::atomic<float> progress{0.f};
+		std::atomic<bool> cancelled{false};
+	};
+
 	struct Entry {
 		bool isValid() const { return id; }
 
 		unsigned id = 0; // empty job
 		QString name;
 		QVariant userData;
-		float progress = 0.f;
+		float progress = 0.f; // as of last sample
 		bool isCancelled = false;
+		std::shared_ptr<Slot> slot;
 	};
 
 	static std::shared_ptr<JobRegistry> get(); // singleton
 	static void run(const Task &task, const std::vector<QPointer<QObject>> &monitors);
+	static void run(const std::vector<Task> &tasks, const std::vector<QPointer<QObject>> &monitors);
 	static void pipeline(const std::vector<Task> &tasks,
 	                     const std::vector<QPointer<QObject>> &monitors);
 
 	Entry job(unsigned id);
 	void cancelJob(unsigned id);
 	void setJobProgress(unsigned id, float progress);
+	// notify monitors of jobs that progressed since last call
+	void sampleProgress();
 
 	Entry getCurrentJob();
-	bool isCurrentJobCancelled();
+	// empty if there is no job in this thread; lock-free, as the two below
+	static std::shared_ptr<Slot> getCurrentSlot();
+	static bool isCurrentJobCancelled();
 	void startCurrentJob(Task::Type type, const std::vector<QString> &fields,
 	                     const QVariant &userData = {});
 	void addCurrentJobMonitor(QPointer<QObject> monitor);
-	void setCurrentJobProgress(float progress);
+	static void setCurrentJobProgress(float progress);
 	void endCurrentJob();
 
+	/* run fun in the calling thread, within the TBB arena of a priority class, so parallel
+	 * algorithms in fun use its workers. Higher classes get worker threads first. Jobs run
+	 * in the arena of their task; use this directly for computations outside of jobs, e.g.
+	 * in the GUI thread. Only call from the GUI thread or the global thread pool. */
+	static void execute(Task::Priority priority, const std::function<void()> &fun);
+	/* TBB worker threads of a priority class (default: one per core), in addition to the
+	 * threads running jobs; call before first use */
+	static void setConcurrency(Task::Priority priority, int threads);
+
 protected:
 	using JobMap = std::unordered_map<QThread*, Entry>;
+	struct Node; // scheduled task, see cpp file
+
+	void schedule(const std::vector<Task> &tasks, const std::vector<QPointer<QObject>> &monitors,
+	              bool chained);
+	void launch(std::shared_ptr<Node> node);
+	void finish(const std::shared_ptr<Node> &node);
 
 	JobMap::iterator idToEntry(unsigned id);
 	JobMap::iterator threadToEntry();
 	void createEntry(Task::Type type, const std::vector<QString> &fields, const QVariant &userData);
 	void erase(JobMap::iterator entry);
-	void updateProgress(JobMap::iterator entry, float progress);
 
 	void notifyMonitors(unsigned jobId, const char *signal);
 
@@ -111,6 +159,10 @@ protected:
 	JobMap jobs;
 	std::unordered_multimap<unsigned, QPointer<QObject>> monitors;
 	QReadWriteLock lock{QReadWriteLock::RecursionMode::Recursive};
+
+	// unfinished tasks by what they provide
+	std::multimap<QString, std::shared_ptr<Node>> providers;
+	std::mutex scheduleLock;
 };
 
 #endif // JOBREGISTRY_H
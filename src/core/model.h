@@ -1,6 +1,8 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include "symmetricmatrix.h"
+
 #include <opencv2/core/core.hpp>
 #include <QMetaType>
 #include <QString>
@@ -28,6 +30,13 @@ enum class Distance {
 	EMD, // Earth Mover's Distance
 };
 
+enum class Linkage { // of agglomerative hierarchical clustering
+	AVERAGE,
+	SINGLE,
+	COMPLETE,
+	WARD,
+};
+
 enum class DistDirection { // note: see initializer of Representations::distances
 	PER_PROTEIN,
 	PER_DIMENSION,
@@ -48,7 +57,26 @@ Q_DECLARE_METATYPE(Protein)
 
 struct Features {
 	using Ptr = std::unique_ptr<Features>;
-	using Vec = std::vector<std::vector<double>>;
+
+	/* storage type of features and scores, chosen per dataset */
+	enum class Precision {
+		DOUBLE,
+		SINGLE, // float32
+		QUANTIZED // uint16, decoded by Matrix::scale and Matrix::offset
+	};
+
+	/* one row per protein, stored in a single contiguous (and aligned) block.
+	 * Element type is double, float or unsigned short (see Precision); actual
+	 * values are stored values times scale plus offset. Use features::visit()
+	 * for typed access and features::row_of() for a decoded row. */
+	struct Matrix : cv::Mat {
+		Matrix() = default;
+		explicit Matrix(const cv::Mat &data, double scale = 1., double offset = 0.)
+		    : cv::Mat(data), scale(scale), offset(offset) {}
+
+		double scale = 1.;
+		double offset = 0.;
+	};
 	struct Range {
 		double scale() const { return 1./(max - min); }
 
@@ -76,12 +104,12 @@ struct Features {
 	std::unordered_map<ProteinId, unsigned> protIndex;
 
 	// original data
-	Vec features;
+	Matrix features;
 	Range featureRange;
 	bool logSpace = false;
 
 	// measurement scores
-	Vec scores;
+	Matrix scores;
 	Range scoreRange;
 };
 
@@ -90,7 +118,7 @@ struct Representations {
 	using Pointset = QVector<QPointF>;
 	std::map<QString, Pointset> displays;
 	// distance/correlation matrices
-	std::map<DistDirection, std::map<Distance, cv::Mat1f>> distances = {
+	std::map<DistDirection, std::map<Distance, SymmetricMatrix>> distances = {
 	    {{DistDirection::PER_PROTEIN}, {}},
 	    {{DistDirection::PER_DIMENSION}, {}}
 	};
@@ -111,6 +139,12 @@ struct Annotations {
 
 		// MEANSHIFT: k parameter used in computation
 		float k = 1.f;
+		// MEANSHIFT: distance used for bandwidths and kernel
+		enum Metric {
+			L1, // on features normalized to unit length, historic default
+			L2, // on features as they are
+			L2_NORMALIZED // on features normalized to unit length
+		} metric = L1;
 
 		// HIERCUT: source hierarchy
 		unsigned hierarchy = 0; // 0 means none
@@ -137,6 +171,7 @@ struct Annotations {
 	// order of clusters (based on size/name/etc)
 	std::vector<unsigned> order;
 };
+Q_DECLARE_METATYPE(Annotations::Meta::Metric)
 
 struct HrClustering {
 	struct Meta {
@@ -153,9 +188,21 @@ struct HrClustering {
 		std::optional<ProteinId> protein;
 	};
 
+	/* precomputed for partitioning at any granularity, see hierarchy::index() */
+	struct CutIndex {
+		// cluster indices, parents before children
+		std::vector<unsigned> topDown;
+		// a cluster is split when the cut bound is below; 0 for leaves (never split)
+		std::vector<unsigned> splitBelow;
+		// cluster has no parent
+		std::vector<bool> root;
+	};
+
 	Meta meta;
 
 	std::vector<Cluster> clusters;
+	// shared between copies, as clusters are immutable after creation
+	std::shared_ptr<const CutIndex> cuts;
 };
 
 using Structure = std::variant<Annotations, HrClustering>;
@@ -175,7 +222,9 @@ struct Order {
 		FILE,
 		NAME,
 		HIERARCHY,
-		CLUSTERING
+		CLUSTERING,
+		HIERARCHY_OPTIMAL, // hierarchy with optimal leaf ordering
+		SPECTRAL // seriation by similarity graph
 	} type = FILE;
 	std::variant<std::monostate, Annotations::Meta, HrClustering::Meta> source = std::monostate();
 };
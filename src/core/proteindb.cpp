@@ -1,6 +1,7 @@
 #include "proteindb.h"
 #include "../compute/annotations.h"
 #include "../compute/colors.h"
+#include "../compute/hierarchy.h"
 
 #include <QTextStream>
 #include <QRegularExpression>
@@ -24,6 +25,11 @@ void ProteinDB::init(std::unique_ptr<ProteinRegister> payload)
 	data.index = std::move(payload->index);
 	data.markers = std::move(payload->markers);
 	data.structures = std::move(payload->structures);
+	for (auto &[_, v] : data.structures) {
+		auto h = std::get_if<HrClustering>(&v);
+		if (h)
+			h->cuts = hierarchy::index(*h);
+	}
 
 	for (auto &[k, _] : data.structures)
 		data.nextStructureId = std::max(data.nextStructureId, k + 1);
@@ -224,6 +230,7 @@ void ProteinDB::addAnnotations(std::unique_ptr<Annotations> a, bool select, bool
 void ProteinDB::addHierarchy(std::unique_ptr<HrClustering> h, bool select)
 {
 	auto name = h->meta.name;
+	h->cuts = hierarchy::index(*h); // outside lock
 
 	data.l.lockForWrite();
 	auto id = data.nextStructureId++; // pick an id that was not in use before
@@ -0,0 +1,49 @@
+#include "symmetricmatrix.h"
+
+#include <QTemporaryFile>
+#include <QDir>
+#include <iostream>
+
+// see setScratch()
+static std::string scratchDirectory;
+static size_t mappingThreshold = size_t(1) << 31; // 2 GiB, reached at ~33k proteins
+
+void SymmetricMatrix::setScratch(const std::string &directory, size_t threshold)
+{
+	scratchDirectory = directory;
+	mappingThreshold = threshold;
+}
+
+/* create a scratch file of given size and map it; file is removed with the last reference */
+static std::shared_ptr<float> mapScratch(size_t bytes)
+{
+	auto directory = (scratchDirectory.empty() ? QDir::tempPath()
+	                                           : QString::fromStdString(scratchDirectory));
+	auto file = std::make_shared<QTemporaryFile>(directory + "/belki-matrix-XXXXXX");
+	if (!file->open() || !file->resize((qint64)bytes)) {
+		std::cerr << "Could not create scratch file: " << file->errorString().toStdString() << std::endl;
+		return {};
+	}
+	auto ptr = file->map(0, (qint64)bytes);
+	if (!ptr) {
+		std::cerr << "Could not map scratch file: " << file->errorString().toStdString() << std::endl;
+		return {};
+	}
+	std::cerr << "Matrix of " << (bytes >> 20) << " MiB mapped to "
+	          << file->fileName().toStdString() << std::endl;
+	return {reinterpret_cast<float*>(ptr), [file] (float *p) {
+		file->unmap(reinterpret_cast<uchar*>(p));
+	}};
+}
+
+SymmetricMatrix::SymmetricMatrix(size_t n, Backing backing)
+    : n(n)
+{
+	auto elements = n * (n + 1) / 2;
+	auto bytes = elements * sizeof(float);
+	if (backing == Backing::MAPPED || (backing == Backing::AUTO && bytes > mappingThreshold))
+		data = mapScratch(bytes);
+	// also fallback when mapping failed
+	if (!data)
+		data = std::shared_ptr<float>(new float[elements], std::default_delete<float[]>());
+}
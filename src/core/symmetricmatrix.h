@@ -0,0 +1,57 @@
+#ifndef SYMMETRICMATRIX_H
+#define SYMMETRICMATRIX_H
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+/* symmetric matrix, e.g. of pairwise distances; only stores upper triangle incl. diagonal,
+ * row by row. Row i starts at element (i, i), so rows can be streamed left to right.
+ * Copies are shallow, like with cv::Mat.
+ *
+ * Large matrices are backed by a memory-mapped scratch file, so the OS can page them out
+ * instead of running out of RAM. The scratch directory should be on disk, not in RAM
+ * (tmpfs), see setScratch(). */
+struct SymmetricMatrix {
+	enum class Backing {
+		AUTO, // map file when larger than mapping threshold, see setScratch()
+		MEMORY,
+		MAPPED
+	};
+	/* directory for scratch files (empty: temp directory, see QDir::tempPath()) and size
+	 * in bytes from which AUTO maps a file (default: 2 GiB); call before use */
+	static void setScratch(const std::string &directory, size_t mappingThreshold);
+
+	SymmetricMatrix() = default;
+	explicit SymmetricMatrix(size_t n, Backing backing = Backing::AUTO);
+
+	size_t size() const { return n; } // side length
+	bool empty() const { return n == 0; }
+
+	float operator()(size_t i, size_t j) const { return data.get()[index(i, j)]; }
+	float& operator()(size_t i, size_t j) { return data.get()[index(i, j)]; }
+
+	// stored part of row i, elements (i, i) to (i, n - 1)
+	const float* row(size_t i) const { return data.get() + offset(i); }
+	float* row(size_t i) { return data.get() + offset(i); }
+	// full row i, elements (i, 0) to (i, n - 1)
+	void expandRow(size_t i, float *target) const {
+		for (size_t j = 0; j < i; ++j)
+			target[j] = data.get()[offset(j) + i - j];
+		std::copy(row(i), row(i) + (n - i), target + i);
+	}
+
+	const float* begin() const { return data.get(); }
+	const float* end() const { return data.get() + offset(n); }
+
+protected:
+	size_t offset(size_t i) const { return i * n - (i * (i - 1)) / 2; }
+	size_t index(size_t i, size_t j) const {
+		return (i <= j ? offset(i) + j - i : offset(j) + i - j);
+	}
+
+	size_t n = 0;
+	std::shared_ptr<float> data;
+};
+
+#endif
@@ -20,7 +20,9 @@ WindowState::WindowState(GuiState &global)
 	addOrderItem("Position in file", QIcon::fromTheme("sort_incr"), Order::FILE);
 	addOrderItem("Protein name", QIcon::fromTheme("sort-name"), Order::NAME);
 	addOrderItem("Hierarchy", QIcon{":/icons/type-hierarchy.svg"}, Order::HIERARCHY);
+	addOrderItem("Hierarchy, optimal leaf order", QIcon{":/icons/type-hierarchy.svg"}, Order::HIERARCHY_OPTIMAL);
 	addOrderItem("Clustering/Annotations", QIcon{":/icons/type-annotations.svg"}, Order::CLUSTERING);
+	addOrderItem("Spectral seriation", {}, Order::SPECTRAL);
 }
 
 ProteinDB& WindowState::proteins()
@@ -50,9 +52,9 @@ void WindowState::setOrder(Order::Type type)
 
 	preferredOrder = type;
 	// translate type to description
-	if (type == Order::FILE || type == Order::NAME)
+	if (type == Order::FILE || type == Order::NAME || type == Order::SPECTRAL)
 		order = {type};
-	if (type == Order::HIERARCHY)
+	if (type == Order::HIERARCHY || type == Order::HIERARCHY_OPTIMAL)
 		order = {type, hierarchy};
 	if (type == Order::CLUSTERING) {
 		if (annotations.type == Annotations::Meta::HIERCUT)
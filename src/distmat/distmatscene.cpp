@@ -278,19 +278,20 @@ void DistmatScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 	}
 
 	// use floored coordinates, as everything in [0,1[ lies over pixel 0
-	cv::Point_<unsigned> idx = {(unsigned)pos.x(), (unsigned)pos.y()};
+	auto scale = pixelToIndex();
+	cv::Point_<unsigned> idx = {(unsigned)(pos.x() * scale), (unsigned)(pos.y() * scale)};
 	if (currentDirection == DistDirection::PER_PROTEIN) {
 		// need to back-translate
 		auto d = data->peek<Dataset::Structure>();
 		auto &order = d->fetch(state->order);
-		idx = {order.index[(size_t)pos.x()], order.index[(size_t)pos.y()]};
+		idx = {order.index[idx.x], order.index[idx.y]};
 	}
 
 	/* display current value */
 	auto r = data->peek<Dataset::Representations>();
 	auto it = r->distances.at(currentDirection).find(measure);
 	if (it != r->distances.at(currentDirection).end()) {
-		display->setToolTip(QString::number((double)it->second(idx), 'f', 2));
+		display->setToolTip(QString::number((double)it->second(idx.y, idx.x), 'f', 2));
 	}
 
 	if (currentDirection == DistDirection::PER_DIMENSION)
@@ -307,7 +308,7 @@ void DistmatScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 {
 	if (dialogMode && display->scene() && currentDirection == DistDirection::PER_DIMENSION) {
 		// see mouseMoveEvent()
-		auto y = (unsigned)display->mapFromScene(event->scenePos()).y();
+		auto y = (unsigned)(display->mapFromScene(event->scenePos()).y() * pixelToIndex());
 		if (y < dimensionSelected.size()) {
 			dimensionSelected[y] = !dimensionSelected[y];
 			updateVisibilities();
@@ -319,6 +320,16 @@ void DistmatScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 	QGraphicsScene::mouseReleaseEvent(event);
 }
 
+qreal DistmatScene::pixelToIndex()
+{
+	// large matrices are displayed downsampled, see distmat::computeImage()
+	auto r = data->peek<Dataset::Representations>();
+	auto it = r->distances.at(currentDirection).find(measure);
+	if (it == r->distances.at(currentDirection).end())
+		return 1.;
+	return it->second.size() / display->boundingRect().width();
+}
+
 qreal DistmatScene::computeCoord(unsigned sampleIndex)
 {
 	auto s = data->peek<Dataset::Structure>();
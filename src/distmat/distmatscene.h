@@ -91,6 +91,7 @@ protected:
 	void rearrange();
 	void updateVisibilities();
 	void updateRenderQuality();
+	qreal pixelToIndex();
 	qreal computeCoord(unsigned sampleIndex);
 
 	DistDirection currentDirection = DistDirection::PER_DIMENSION;
@@ -97,6 +97,8 @@ void DistmatTab::setupOrderUI()
 			Task task{[s=windowState,d=selected().data] { d->computeOrder(s->order); },
 				      Task::Type::ORDER,
 				      {orderSelect->currentText(), selected().data->config().name}};
+			if (windowState->order.type == Order::CLUSTERING) // wait for ongoing clustering
+				task.needs = {selected().data->resource(Dataset::Touch::ANNOTATIONS)};
 			JobRegistry::run(task, windowState->jobMonitors);
 		}
 	});
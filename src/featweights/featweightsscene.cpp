@@ -1,6 +1,7 @@
 #include "featweightsscene.h"
 #include "../compute/colors.h"
 #include "../compute/features.h"
+#include "jobregistry.h"
 
 #include <QPainter>
 #include <QGraphicsPixmapItem>
@@ -70,27 +71,25 @@ void FeatweightsScene::computeWeights()
 	/* calculate weights if appr. method selected and markers available */
 	if (weighting != Weighting::UNWEIGHTED && !markers.empty()) {
 		/* compose set of voters by all marker proteins found in current dataset */
-		std::vector<const std::vector<double>*> voters;
+		std::vector<cv::Mat1d> voters;
 		for (auto& m : markers) {
-			try { voters.push_back(&feat[m]); } catch (...) {}
+			if (m < (size_t)feat.rows)
+				voters.push_back(features::row_of(feat, (int)m));
 		}
 
 		/* setup weighters */
 		std::map<Weighting, std::function<void(size_t)>> weighters;
 		weighters[Weighting::ABSOLUTE] = [&] (size_t dim) {
 			for (auto &f : voters) {
-				weights[dim] += (*f)[dim];
+				weights[dim] += f((int)dim);
 			}
 		};
 		weighters[Weighting::RELATIVE] = [&] (size_t dim) { // weight against own baseline
 			// collect baseline first
-			double baseline = std::accumulate(feat.cbegin(), feat.cend(), 0.,
-			                                  [dim,n=1./feat.size()] (auto a, auto &p) {
-				return a += p[dim] * n;
-			});
+			double baseline = cv::mean(feat.col((int)dim))[0] * feat.scale + feat.offset;
 
 			for (auto &f : voters) {
-				auto value = (*f)[dim];
+				auto value = f((int)dim);
 				if (value > baseline)
 					weights[dim] += value / baseline;
 			}
@@ -102,11 +101,11 @@ void FeatweightsScene::computeWeights()
 				double baseline = 0;
 				for (unsigned i = 0; i < weights.size(); ++i) {
 					if (i != dim)
-						baseline = std::max(baseline, (*f)[i] * n);
+						baseline = std::max(baseline, f((int)i) * n);
 				}
 				if (baseline < 0.001)
 					baseline = 1.;
-				auto value = (*f)[dim];
+				auto value = f((int)dim);
 				if (value > baseline)
 					weights[dim] += value / baseline;
 			}
@@ -114,7 +113,9 @@ void FeatweightsScene::computeWeights()
 
 		/* apply weighting and normalize */
 		weights.resize(len, 0.);
-		tbb::parallel_for((size_t)0, weights.size(), weighters[weighting]);
+		JobRegistry::execute(Task::Priority::INTERACTIVE, [&] {
+			tbb::parallel_for((size_t)0, weights.size(), weighters[weighting]);
+		});
 		auto total = cv::sum(weights)[0];
 		if (total > 0.001) {
 			std::for_each(weights.begin(), weights.end(), [s=1./total] (double &v) { v *= s; });
@@ -127,14 +128,14 @@ void FeatweightsScene::computeWeights()
 	if (weights.empty())
 		weights.assign(len, 1./(double)len);
 
-	computeImage(feat);
+	JobRegistry::execute(Task::Priority::INTERACTIVE, [&] { computeImage(feat); });
 
 	d.unlock();
 	computeMarkerContour();
 	setDisplay();
 }
 
-void FeatweightsScene::computeImage(const Features::Vec &feat)
+void FeatweightsScene::computeImage(const Features::Matrix &feat)
 {
 	cv::Size bins = {400, 400}; // TODO: adapt to screen
 	cv::Size2d stepSize = {1./(bins.width), 1./(bins.height)};
@@ -145,7 +146,7 @@ void FeatweightsScene::computeImage(const Features::Vec &feat)
 	matrix = cv::Mat1f(bins, 0);
 	cv::Mat1f relmatrix(bins, 0);
 
-	contours = std::vector<std::vector<unsigned>>(feat.size(),
+	contours = std::vector<std::vector<unsigned>>((size_t)feat.rows,
 	                                              std::vector<unsigned>((unsigned)bins.width));
 
 	/* go through critera x (0…1) and, for each protein, measure achieved score y
@@ -154,28 +155,32 @@ void FeatweightsScene::computeImage(const Features::Vec &feat)
 	 * Outer loop over x instead of proteins so threads do not interfer when writing
 	 * to matrix */
 	tbb::parallel_for(0, matrix.cols, [&] (int x) {
-		for (size_t p = 0; p < feat.size(); ++p) {
-			auto thresh = x * stepSize.width;
-			double score = 0;
-			for (unsigned dim = 0; dim < weights.size(); dim++) {
-				if (feat[p][dim] >= thresh)
-					score += weights[dim];
-			}
-			auto y = std::min((int)(score / stepSize.height), matrix.rows - 1);
-			for (int yy = 0; yy <= y; ++yy) // increase absolute count
-				matrix(yy, x)++;
-			if (markers.count(p)) {
-				for (int yy = 0; yy <= y; ++yy) // increase relative count
-					relmatrix(yy, x)++;
+		// compare stored values to a threshold in stored units
+		auto thresh = (x * stepSize.width - feat.offset) / feat.scale;
+		features::visit(feat, [&] (auto fs) {
+			for (int p = 0; p < fs.rows; ++p) {
+				auto f = fs[p];
+				double score = 0;
+				for (unsigned dim = 0; dim < weights.size(); dim++) {
+					if (f[dim] >= thresh)
+						score += weights[dim];
+				}
+				auto y = std::min((int)(score / stepSize.height), matrix.rows - 1);
+				for (int yy = 0; yy <= y; ++yy) // increase absolute count
+					matrix(yy, x)++;
+				if (markers.count((unsigned)p)) {
+					for (int yy = 0; yy <= y; ++yy) // increase relative count
+						relmatrix(yy, x)++;
+				}
+				contours[(size_t)p][x] = y;
 			}
-			contours[p][x] = y;
-		}
+		});
 	});
 
 	// apply on abs. matrix (use log-scale)
 	cv::Mat matrixL;
 	cv::log(matrix, matrixL);
-	double scale = 1./std::log(feat.size()); // max. count (in lower-left corner)
+	double scale = 1./std::log(feat.rows); // max. count (in lower-left corner)
 	images[0] = Colormap::pixmap(Colormap::magma.apply(matrixL, scale));
 
 	// apply on rel. matrix
@@ -208,7 +213,7 @@ void FeatweightsScene::computeMarkerContour()
 void FeatweightsScene::applyScoreThreshold(double threshold)
 {
 	if (std::isnan(threshold)) {
-		clippedFeatures.clear();
+		clippedFeatures.release();
 	} else {
 		auto d = data->peek<Dataset::Base>();
 		clippedFeatures = features::with_cutoff(d->features, d->scores, threshold);
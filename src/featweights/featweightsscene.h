@@ -65,7 +65,7 @@ protected:
 
 	void setDisplay();
 	void computeWeights();
-	void computeImage(const Features::Vec &features);
+	void computeImage(const Features::Matrix &features);
 	void computeMarkerContour();
 
 	std::set<unsigned> markers; // markers in dataset index (not protein id!)
@@ -83,7 +83,7 @@ protected:
 	WeightBar *weightBar;
 
 	Dataset::Ptr data;
-	Features::Vec clippedFeatures; // score threshold applied
+	Features::Matrix clippedFeatures; // score threshold applied
 	QVector<QColor> colorset;
 };
 
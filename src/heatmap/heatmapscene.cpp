@@ -14,7 +14,7 @@ HeatmapScene::HeatmapScene(Dataset::Ptr data)
 	auto d = data->peek<Dataset::Base>();
 
 	/* build up scene with data */
-	profiles.resize(d->features.size());
+	profiles.resize((size_t)d->features.rows);
 	for (unsigned i = 0; i < profiles.size(); ++i) {
 		// setup profile graphics item
 		auto h = new Profile(i, d);
@@ -191,7 +191,9 @@ void HeatmapScene::recolor()
 HeatmapScene::Profile::Profile(unsigned index, View<Dataset::Base> &d)
     : id(d->protIds[index]), index(index)
 {
-	auto feat = cv::Mat(d->features[index]);
+	auto len = d->features.cols;
+	// column view on the profile
+	cv::Mat feat = features::row_of(d->features, (int)index).reshape(1, len);
 	auto range = d->featureRange;
 	if (d->logSpace) {
 		// important: need to operate on a copy of the data!
@@ -204,7 +206,7 @@ HeatmapScene::Profile::Profile(unsigned index, View<Dataset::Base> &d)
 
 	if (d->hasScores()) {
 		// apply score colormap flipped (low scores are better)
-		scores = Colormap::stoplight_mild.apply(cv::Mat(d->scores[index]) * -1.,
+		scores = Colormap::stoplight_mild.apply(features::row_of(d->scores, (int)index).reshape(1, len) * -1.,
 		                         d->scoreRange.scale(), -d->scoreRange.max);
 	}
 	setAcceptHoverEvents(true);
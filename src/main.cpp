@@ -1,5 +1,7 @@
 #include "datahub.h"
 #include "guistate.h"
+#include "jobregistry.h"
+#include "symmetricmatrix.h"
 #include "utils.h"
 
 // for registering meta types
@@ -9,7 +11,9 @@
 #include <QApplication>
 #include <QIcon>
 #include <QSurfaceFormat>
+#include <QCommandLineParser>
 
+#include <Eigen/Core>
 #include <iostream>
 
 #if defined(QT_STATIC) && defined(_WIN32)
@@ -109,8 +113,56 @@ int main(int argc, char *argv[])
 	QApplication a(argc, argv);
 	a.setQuitOnLastWindowClosed(false);
 
+	QCommandLineParser parser;
+	parser.addHelpOption();
+	parser.addVersionOption();
+	parser.addPositionalArgument("project", "Project file to open.", "[project]");
+	parser.addOptions({
+	    {"interactive-threads", "Worker threads for computations the GUI waits for.", "n"},
+	    {"normal-threads", "Worker threads for regular computations.", "n"},
+	    {"background-threads", "Worker threads for bulk and speculative computations.", "n"},
+	    {"scratch-dir", "Map large matrices to files in <dir> (default: temp directory).", "dir"},
+	    {"map-threshold", "Map matrices larger than <size> MiB (default: 2048).", "size"},
+	});
+	parser.process(a);
+
+	/* configure thread usage before any computation starts */
+	std::map<QString, Task::Priority> threadOptions = {
+	    {"interactive-threads", Task::Priority::INTERACTIVE},
+	    {"normal-threads", Task::Priority::NORMAL},
+	    {"background-threads", Task::Priority::BACKGROUND}};
+	for (auto &[option, priority] : threadOptions) {
+		if (!parser.isSet(option))
+			continue;
+		bool ok;
+		auto threads = parser.value(option).toInt(&ok);
+		if (!ok || threads < 0) {
+			std::cerr << "Invalid thread count " << parser.value(option).toStdString() << std::endl;
+			return 1;
+		}
+		JobRegistry::setConcurrency(priority, threads);
+	}
+	/* Eigen parallelizes large products through OpenMP, which ignores the arenas
+	 * above and oversubscribes the cores when a product already runs inside a TBB
+	 * task (distmat tiles, tapkee in dimred). Keep it single-threaded, so that all
+	 * parallelism comes from our jobs. */
+	Eigen::setNbThreads(1);
+
+	/* configure out-of-core storage */
+	unsigned long long threshold = 2048; // MiB
+	if (parser.isSet("map-threshold")) {
+		bool ok;
+		threshold = parser.value("map-threshold").toULongLong(&ok);
+		if (!ok) {
+			std::cerr << "Invalid mapping threshold " << parser.value("map-threshold").toStdString() << std::endl;
+			return 1;
+		}
+	}
+	SymmetricMatrix::setScratch(parser.value("scratch-dir").toStdString(), (size_t)threshold << 20);
+
 	/* start initial instance */
-	instantiate(argc >= 2 ? argv[1] : QString{});
+	auto positional = parser.positionalArguments();
+	instantiate(positional.empty() ? QString{} : positional.front());
 
 	/* cleanup */
 	a.connect(&a, &QApplication::aboutToQuit, [] { cleanup(); });
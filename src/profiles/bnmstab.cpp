@@ -74,6 +74,7 @@ BnmsTab::BnmsTab(QWidget *parent) :
 		auto &current = selected();
 		DatasetConfiguration conf;
 		conf.parent = current.data->config().id;
+		conf.precision = current.data->config().precision;
 		auto [left, right] = current.rangeSelect->range();
 		conf.bands.resize(size_t(right) - size_t(left));
 		std::iota(conf.bands.begin(), conf.bands.end(), unsigned(left));
@@ -153,7 +154,7 @@ void BnmsTab::deselectDataset()
 void BnmsTab::addDataset(Dataset::Ptr data)
 {
 	auto &state = addData<DataState>(data);
-	state.components.resize(data->peek<Dataset::Base>()->features.size());
+	state.components.resize((size_t)data->peek<Dataset::Base>()->features.rows);
 	state.scene = std::make_unique<BnmsChart>(data, state.components);
 	state.refScene = std::make_unique<ReferenceChart>(data, state.components);
 	state.scene->toggleLabels(true); // always show labels in lower chart
@@ -334,7 +335,8 @@ void BnmsTab::loadComponents()
 		line.pop_front();
 		/* hack: our profiles do not sum to 1, but as a pdf they should. so we
 		 * scale the pdfs the other way round by manipulating their weights. */
-		double scale = cv::sum(b->features[row])[0];
+		double scale = cv::sum(b->features.row((int)row))[0] * b->features.scale
+		               + b->features.offset * b->features.cols;
 		for (auto i = 0; i < line.size(); i+=3)
 			target[row].push_back({scale*line[i+2].toDouble(), // weight
 			                       line[i].toDouble(), // mean
@@ -346,7 +346,9 @@ void ProfileChart::setupSeries()
 			if (d->hasScores()) { // visualize scores through points along polyline
 				s->setPointsVisible(true);
 				// note: a copy of the relevant scores is stored in the lambda object
-				s->setDynamicPointSize([s=d->scores[index],max=d->scoreRange.max] (int index) {
+				auto scores = features::row_of(d->scores, (int)index);
+				s->setDynamicPointSize([s=std::vector<double>(scores.begin(), scores.end()),
+				                       max=d->scoreRange.max] (int index) {
 					return s[(size_t)index] * 3./max;
 				});
 			}
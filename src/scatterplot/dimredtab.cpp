@@ -154,6 +154,7 @@ void DimredTab::computeDisplay(const dimred::Method &method) {
 	auto d = selected().data;
 	Task task{[d,name=method.name] { d->computeDisplay(name); },
 	          Task::Type::COMPUTE, {method.description, d->config().name}};
+	task.priority = Task::Priority::BACKGROUND; // e.g. tSNE takes long, keep views responsive
 	// note: when we have a local progress indicator thingy, we can add it to monitors
 	JobRegistry::run(task, windowState->jobMonitors);
 }
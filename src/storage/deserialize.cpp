@@ -58,6 +58,12 @@ Structure Storage::deserializeStructure<2>(const QCborMap &source, unsigned id)
 		ret.meta.dataset = meta.value("dataset").toInteger(0); // optional, default 0
 		// individual parameters are set depending on type, but we can just default
 		ret.meta.k = meta.value("k").toDouble(1.);
+		std::map<QString, Annotations::Meta::Metric> metricMap{
+			{"l1", Annotations::Meta::L1},
+			{"l2", Annotations::Meta::L2},
+			{"l2-normalized", Annotations::Meta::L2_NORMALIZED},
+		};
+		ret.meta.metric = metricMap.at(meta.value("metric").toString("l1"));
 		ret.meta.hierarchy = meta.value("hierarchy").toInteger(0);
 		ret.meta.granularity = meta.value("granularity").toInteger(0);
 		ret.meta.pruned = meta.value("pruned").toBool(true);
@@ -113,6 +119,7 @@ std::shared_ptr<Dataset> Storage::deserializeDataset<2>(const QCborMap &source)
 		for (auto i : bands)
 			ret.bands.push_back(i.toInteger());
 		ret.scoreThresh = src.value("scoreThreshold").toDouble();
+		ret.precision = (Features::Precision)src.value("precision").toInteger(0);
 		return ret;
 	};
 
@@ -125,13 +132,17 @@ std::shared_ptr<Dataset> Storage::deserializeDataset<2>(const QCborMap &source)
 		return ret;
 	};
 
-	auto importFeats = [] (const QCborMap& src, Features::Vec &data, Features::Range &range) {
-		for (auto vec : src.value("data").toArray()) {
-			std::vector<double> row;
-			for (auto v : vec.toArray())
-				row.push_back(v.toDouble());
-			data.push_back(row);
+	auto importFeats = [] (const QCborMap& src, Features::Matrix &data, Features::Range &range) {
+		auto rows = src.value("data").toArray();
+		auto len = (rows.empty() ? 0 : (int)rows.first().toArray().size());
+		cv::Mat1d values((int)rows.size(), len, 0.);
+		for (int i = 0; i < values.rows; ++i) {
+			auto row = rows.at(i).toArray();
+			auto target = values[i];
+			for (int j = 0; j < std::min(len, (int)row.size()); ++j)
+				target[j] = row.at(j).toDouble();
 		}
+		data = Features::Matrix(values);
 		auto irange = src.value("range").toArray();
 		range.min = irange.first().toDouble();
 		range.max = irange.last().toDouble();
@@ -36,6 +36,9 @@ Features::Ptr Storage::readSource(QTextStream in, const ReadConfig &config)
 	/* read file into Features object */
 	auto ret = std::make_unique<Features>();
 	std::map<QString, unsigned> dimensions;
+	/* matrix size is only known at the end, so keep entries until then */
+	struct Entry { size_t row, col; double feat, score; };
+	std::vector<Entry> entries;
 	while (!in.atEnd()) {
 		auto line = in.readLine().split("\t");
 		if (line.empty() || line[0].isEmpty())
@@ -55,10 +58,7 @@ Features::Ptr Storage::readSource(QTextStream in, const ReadConfig &config)
 		auto index = ret->protIndex.find(protid);
 		if (index == ret->protIndex.end()) {
 			ret->protIds.push_back(protid);
-			auto len = ret->protIds.size();
-			ret->features.resize(len, std::vector<double>(dimensions.size()));
-			ret->scores.resize(len, std::vector<double>(dimensions.size()));
-			row = len - 1;
+			row = ret->protIds.size() - 1;
 			ret->protIndex[protid] = row;
 		} else {
 			row = index->second;
@@ -69,12 +69,7 @@ Features::Ptr Storage::readSource(QTextStream in, const ReadConfig &config)
 		auto dIndex = dimensions.find(line[nameCol]);
 		if (dIndex == dimensions.end()) {
 			ret->dimensions.append(line[nameCol]);
-			auto len = (size_t)ret->dimensions.size();
-			for (auto &i : ret->features)
-				i.resize(len);
-			for (auto &i : ret->scores)
-				i.resize(len);
-			col = len - 1;
+			col = (size_t)ret->dimensions.size() - 1;
 			dimensions[line[nameCol]] = col;
 		} else {
 			col = dIndex->second;
@@ -94,16 +89,24 @@ Features::Ptr Storage::readSource(QTextStream in, const ReadConfig &config)
 			break; // avoid message flood
 		}
 
-		/* fill-in features and scores */
-		ret->features[row][col] = feat;
-		ret->scores[row][col] = std::max(score, 0.); // TODO temporary clipping
+		entries.push_back({row, col, feat, std::max(score, 0.)}); // TODO temporary clipping
 	}
 
-	if (ret->features.empty() || ret->dimensions.empty()) {
+	if (ret->protIds.empty() || ret->dimensions.empty()) {
 		emit message({"Could not read any valid data rows from file!"});
 		return {};
 	}
 
+	/* fill-in features and scores */
+	cv::Mat1d feats((int)ret->protIds.size(), ret->dimensions.size(), 0.);
+	cv::Mat1d scores(feats.size(), 0.);
+	for (auto &e : entries) {
+		feats((int)e.row, (int)e.col) = e.feat;
+		scores((int)e.row, (int)e.col) = e.score;
+	}
+	ret->features = Features::Matrix(feats);
+	ret->scores = Features::Matrix(scores);
+
 	finalizeRead(*ret, config.normalize);
 	return ret;
 }
@@ -126,6 +129,7 @@ Features::Ptr Storage::readSimpleSource(QTextStream &in, bool normalize)
 	auto ret = std::make_unique<Features>();
 	ret->dimensions = trimCrap(header);
 	auto len = ret->dimensions.size();
+	std::vector<double> coeffs; // all rows, read into one block
 	std::set<QString> seen; // names of read proteins
 	while (!in.atEnd()) {
 		auto line = in.readLine().split("\t");
@@ -152,13 +156,15 @@ Features::Ptr Storage::readSimpleSource(QTextStream &in, bool normalize)
 
 		/* read coefficients */
 		bool success = true;
-		std::vector<double> coeffs((size_t)len);
+		auto offset = coeffs.size();
+		coeffs.resize(offset + (size_t)len);
 		for (int i = 0; i < len; ++i) {
 			bool ok;
-			coeffs[(size_t)i] = line[i+1].toDouble(&ok);
+			coeffs[offset + (size_t)i] = line[i+1].toDouble(&ok);
 			success = success && ok;
 		}
 		if (!success) {
+			coeffs.resize(offset);
 			QString err{"Stopped at protein '%1', malformed row!"};
 			emit message({"Could not parse complete file!", err.arg(name)});
 			break; // avoid message flood
@@ -167,14 +173,15 @@ Features::Ptr Storage::readSimpleSource(QTextStream &in, bool normalize)
 		/* append */
 		ret->protIndex[protid] = ret->protIds.size();
 		ret->protIds.push_back(protid);
-		ret->features.push_back(std::move(coeffs));
 	}
 
-	if (ret->features.empty()) {
+	if (ret->protIds.empty()) {
 		emit message({"Could not read any valid data rows from file!"});
 		return {};
 	}
 
+	ret->features = Features::Matrix(cv::Mat1d((int)ret->protIds.size(), len, coeffs.data()).clone());
+
 	finalizeRead(*ret, normalize);
 	return ret;
 }
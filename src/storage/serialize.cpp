@@ -1,5 +1,6 @@
 #include "storage.h"
 #include "dataset.h"
+#include "../compute/features.h"
 
 #include <QIODevice>
 #include <QCborValue>
@@ -48,15 +49,16 @@ QCborValue Storage::serializeDataset(std::shared_ptr<const Dataset> src)
 			{"parent", config.parent},
 			{"normalized", config.normalized},
 			{"bands", bands},
-			{"scoreThreshold", config.scoreThresh}
+			{"scoreThreshold", config.scoreThresh},
+			{"precision", (int)config.precision}
 		};
 	};
 
-	auto packFeatures = [] (const Features::Vec &src, const Features::Range &range) {
+	auto packFeatures = [] (const Features::Matrix &src, const Features::Range &range) {
 		QCborArray data;
-		for (auto vec : src) {
+		for (int i = 0; i < src.rows; ++i) {
 			QCborArray cVec;
-			for (auto v : vec)
+			for (auto v : features::row_of(src, i))
 				cVec.append(v);
 			data.append(cVec);
 		}
@@ -192,6 +194,11 @@ QCborValue Storage::serializeStructure(const Structure &src)
 		case Annotations::Meta::MEANSHIFT:
 			meta.insert({"type", "meanshift"});
 			meta.insert({"k", cl->meta.k});
+			switch (cl->meta.metric) {
+			case Annotations::Meta::L1: meta.insert({"metric", "l1"}); break;
+			case Annotations::Meta::L2: meta.insert({"metric", "l2"}); break;
+			case Annotations::Meta::L2_NORMALIZED: meta.insert({"metric", "l2-normalized"}); break;
+			}
 			meta.insert({"pruned", cl->meta.pruned});
 			break;
 		case Annotations::Meta::HIERCUT:
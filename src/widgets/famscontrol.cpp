@@ -3,15 +3,35 @@
 
 #include "../compute/annotations.h"
 
+#include <QInputDialog>
+#include <QRegularExpression>
+
 FAMSControl::FAMSControl(QWidget *parent) :
     Viewer(new QWidget, parent)
 {
 	setupUi(widget);
 	pruneButton->setDefaultAction(actionPruneClusters);
+	speculateButton->setDefaultAction(actionSpeculate);
+	for (auto &[v, n] : std::map<Annotations::Meta::Metric, QString>{
+	    {Annotations::Meta::L1, "L1"},
+	    {Annotations::Meta::L2, "L2"},
+	    {Annotations::Meta::L2_NORMALIZED, "L2 (normalized)"},
+    }) {
+		metricSelect->addItem(n, QVariant::fromValue(v));
+	}
 
 	stopButton->setVisible(false);
 	connect(kSelect, qOverload<double>(&QDoubleSpinBox::valueChanged), [this] { configure(); });
-	connect(actionPruneClusters, &QAction::toggled, [this] { configure(); });
+	connect(metricSelect, qOverload<int>(&QComboBox::currentIndexChanged),
+	        [this] { configure(); speculate(); });
+	connect(actionPruneClusters, &QAction::toggled, [this] { configure(); speculate(); });
+	connect(actionSpeculate, &QAction::toggled, [this] (bool on) {
+		if (on && !setupSpeculation()) {
+			actionSpeculate->setChecked(false);
+			return;
+		}
+		speculate();
+	});
 	connect(runButton, &QToolButton::clicked, this, &FAMSControl::run);
 	connect(stopButton, &QToolButton::clicked, this, &FAMSControl::stop);
 }
@@ -21,6 +41,7 @@ void FAMSControl::selectDataset(unsigned id)
 	selectData(id); // triggers updateUi()
 	if (windowState->annotations.type == Annotations::Meta::MEANSHIFT)
 		run();
+	speculate();
 }
 
 void FAMSControl::addDataset(Dataset::Ptr data)
@@ -37,6 +58,7 @@ void FAMSControl::configure()
 	/* setup desired annotations and communicate through windowState */
 	Annotations::Meta desc{Annotations::Meta::MEANSHIFT};
 	desc.k = kSelect->value();
+	desc.metric = selectedMetric();
 	desc.pruned = actionPruneClusters->isChecked();
 	if (!annotations::equal(windowState->annotations, desc)) {
 		windowState->annotations = desc;
@@ -60,11 +82,60 @@ void FAMSControl::run()
 	Task task({[desc,data] { data->computeAnnotations(desc); },
 	           Task::Type::COMPUTE_FAMS, {QString::number(desc.k, 'f', 2), data->config().name}});
 	task.userData = data->config().id;
+	task.provides = {data->resource(Dataset::Touch::ANNOTATIONS)};
 	auto monitors = windowState->jobMonitors;
 	monitors.push_back(this);
 	JobRegistry::run(task, monitors);
 }
 
+bool FAMSControl::setupSpeculation()
+{
+	QStringList current;
+	for (auto k : speculationGrid)
+		current << QString::number((double)k);
+	bool ok;
+	auto input = QInputDialog::getText(widget, "Precompute Mean Shift",
+	                                   "Values of k to compute in the background:",
+	                                   QLineEdit::Normal, current.join(" "), &ok);
+	if (!ok)
+		return false;
+
+	std::vector<float> grid;
+	for (auto &token : input.split(QRegularExpression("[\\s,;]+"))) {
+		auto k = token.toFloat(&ok);
+		if (ok && k >= kSelect->minimum() && k <= kSelect->maximum())
+			grid.push_back(k);
+	}
+	if (grid.empty())
+		return false;
+	speculationGrid = grid;
+	return true;
+}
+
+void FAMSControl::speculate()
+{
+	if (!haveData() || !actionSpeculate->isChecked())
+		return;
+
+	auto data = selected().data;
+	auto grid = speculationGrid;
+	auto metric = selectedMetric();
+	auto prune = actionPruneClusters->isChecked();
+	QStringList values;
+	for (auto k : grid)
+		values << QString::number((double)k, 'f', 2);
+	// note: we do not monitor ourselves, our controls are for regular runs, which preempt this
+	Task task({[data,grid,metric,prune] { data->speculateFAMS(grid, metric, prune); },
+	           Task::Type::SPECULATE_FAMS, {values.join(", "), data->config().name}});
+	task.priority = Task::Priority::BACKGROUND;
+	JobRegistry::run(task, windowState->jobMonitors);
+}
+
+Annotations::Meta::Metric FAMSControl::selectedMetric()
+{
+	return metricSelect->currentData().value<Annotations::Meta::Metric>();
+}
+
 void FAMSControl::stop()
 {
 	if (!haveData())
@@ -140,6 +211,7 @@ void FAMSControl::updateUi()
 	bool maySelect = !haveData() || (selected().step != DataState::RUNNING);
 	runButton->setEnabled(mayRun); // do this even if not shown; we use enabled state internally
 	kSelect->setEnabled(maySelect);
+	metricSelect->setEnabled(maySelect);
 	stopButton->setEnabled(mayStop);
 
 	// update progress bar before showing it
@@ -18,6 +18,7 @@ public slots:
 	void configure();
 	void run();
 	void stop();
+	void speculate();
 
 	// job monitor interface
 	void addJob(unsigned jobId);
@@ -38,11 +39,16 @@ protected:
 	};
 
 	bool updateIsEnabled() override { updateUi(); return true; }
+	bool setupSpeculation();
+	Annotations::Meta::Metric selectedMetric();
 	void updateUi();
 	bool isAvailable();
 
 	DataState *byJob(unsigned jobId, bool fresh=false);
 	DataState &selected() { return selectedAs<DataState>(); }
+
+	// k values to precompute in the background, if enabled
+	std::vector<float> speculationGrid = {0.5f, 0.8f, 1.f, 1.2f, 1.5f, 2.f};
 };
 
 #endif // FAMSCONTROL_H
@@ -391,9 +391,15 @@ void MainWindow::setupActions()
 	connect(actionComputeHierarchy, &QAction::triggered, [this] {
 		if (!data)
 			return;
+		/* distances first, so other tasks that need them can wait instead of computing too */
+		auto distances = data->resource(DistDirection::PER_PROTEIN, Dataset::hierarchyDistance);
+		Task prepare{[d=data] { d->computeDistances(DistDirection::PER_PROTEIN, Dataset::hierarchyDistance); },
+			         Task::Type::COMPUTE, {"distances", data->config().name}};
+		prepare.provides = {distances};
 		Task task{[d=data] { d->computeHierarchy(); },
 			      Task::Type::COMPUTE_HIERARCHY, {data->config().name}};
-		JobRegistry::run(task, state->jobMonitors);
+		task.needs = {distances};
+		JobRegistry::run(std::vector<Task>{prepare, task}, state->jobMonitors);
 	});
 }
 void MainWindow::setDatasetControlModel(QStandardItemModel *m)
@@ -504,18 +510,25 @@ void MainWindow::setDataset(Dataset::Ptr selected)
 	if (data) {
 		// let views know before our GUI might send more signals
 		emit datasetSelected(data->id());
-		// tell dataset what we need
-		std::vector<Task> tasks; // use a pipeline to avoid redundant order computation
+		// tell dataset what we need; order waits for annotations to avoid redundant computation
+		auto annotations = data->resource(Dataset::Touch::ANNOTATIONS);
+		std::vector<Task> tasks;
 		if (state->annotations.id) { // simple case
-			tasks.push_back({[s=state,d=data] { d->computeAnnotations(s->annotations); },
-		                     Task::Type::ANNOTATE, {state->annotations.name, data->config().name}});
+			Task task{[s=state,d=data] { d->computeAnnotations(s->annotations); },
+			          Task::Type::ANNOTATE, {state->annotations.name, data->config().name}};
+			task.provides = {annotations};
+			tasks.push_back(task);
 		} else if (state->annotations.type == Annotations::Meta::HIERCUT) {
-			tasks.push_back({[s=state,d=data] { d->computeAnnotations(s->annotations); },
-			                 Task::Type::PARTITION_HIERARCHY, {state->hierarchy.name, data->config().name}});
+			Task task{[s=state,d=data] { d->computeAnnotations(s->annotations); },
+			          Task::Type::PARTITION_HIERARCHY, {state->hierarchy.name, data->config().name}};
+			task.provides = {annotations};
+			tasks.push_back(task);
 		} // note: MEANSHIFT case is handled by FAMSControl
-		tasks.push_back({[s=state,d=data] { d->computeOrder(s->order); },
-		                 Task::Type::ORDER, {"preference", data->config().name}});
-		JobRegistry::pipeline(tasks, state->jobMonitors);
+		Task order{[s=state,d=data] { d->computeOrder(s->order); },
+		           Task::Type::ORDER, {"preference", data->config().name}};
+		order.needs = {annotations};
+		tasks.push_back(order);
+		JobRegistry::run(tasks, state->jobMonitors);
 		// wire updates
 		if (data)
 			connect(data.get(), &Dataset::update, this, &MainWindow::updateState);
@@ -648,15 +661,30 @@ void MainWindow::openFile(Input type, QString fn)
 			return; // nothing selected
 	}
 
+	/* datasets are stored in the precision of the user's choice */
+	auto precision = Features::Precision::DOUBLE;
+	if (type == Input::DATASET || type == Input::DATASET_RAW) {
+		// same choices as in the spawn dialog, in order of Features::Precision
+		QStringList choices = {"64 bit float", "32 bit float", "16 bit quantized"};
+		bool ok;
+		auto choice = QInputDialog::getItem(this, "Import Dataset", "Storage precision:",
+		                                    choices, 0, false, &ok);
+		if (!ok)
+			return; // user cancelled
+		precision = (Features::Precision)choices.indexOf(choice);
+	}
+
 	auto h = &state->hub();
 	auto s = h->store();
 	Task task;
 	switch (type) {
 	case Input::DATASET:
-		task = {[h,fn] { h->importDataset(fn, "Dist"); }, Task::Type::IMPORT_DATASET, {fn}};
+		task = {[h,fn,precision] { h->importDataset(fn, "Dist", precision); },
+		        Task::Type::IMPORT_DATASET, {fn}};
 		break;
 	case Input::DATASET_RAW:
-		task = {[h,fn] { h->importDataset(fn, "AbundanceLeft"); }, Task::Type::IMPORT_DATASET, {fn}};
+		task = {[h,fn,precision] { h->importDataset(fn, "AbundanceLeft", precision); },
+		        Task::Type::IMPORT_DATASET, {fn}};
 		break;
 	case Input::MARKERS:
 		task = {[s,fn] { s->importMarkers(fn); }, Task::Type::IMPORT_MARKERS, {fn}};
@@ -707,8 +735,9 @@ void MainWindow::selectAnnotations(const Annotations::Meta &desc)
 	// compute if not the null case (we are not called for special cases)
 	if (data && desc.id) {
 		// note: prepareAnnotations in our case (types SIMPLE) always also computes order
-		Task task({[s=state,d=data] { d->computeAnnotations(s->annotations); },
-		           Task::Type::ANNOTATE, {desc.name, data->config().name}});
+		Task task{[s=state,d=data] { d->computeAnnotations(s->annotations); },
+		          Task::Type::ANNOTATE, {desc.name, data->config().name}};
+		task.provides = {data->resource(Dataset::Touch::ANNOTATIONS)};
 		JobRegistry::run(task, state->jobMonitors);
 	}
 }
@@ -720,11 +749,13 @@ void MainWindow::selectHierarchy(unsigned id, unsigned granularity, bool pruned)
 	switchHierarchyPartition(granularity, pruned);
 
 	// note: the hierarchy-based order is independent of the hierarchy partition
-	if (!state->orderSynchronizing ||
-	    (state->preferredOrder != Order::HIERARCHY && state->preferredOrder != Order::CLUSTERING))
+	auto preferred = state->preferredOrder;
+	if (!state->orderSynchronizing || (preferred != Order::HIERARCHY &&
+	    preferred != Order::HIERARCHY_OPTIMAL && preferred != Order::CLUSTERING))
 		return;
 
-	state->order = {Order::HIERARCHY, state->hierarchy};
+	state->order = {(preferred == Order::HIERARCHY_OPTIMAL ? preferred : Order::HIERARCHY),
+	                state->hierarchy};
 	emit state->orderChanged();
 	if (data) {
 		Task task{[s=state,d=data] { d->computeOrder(s->order); },
@@ -743,6 +774,7 @@ void MainWindow::switchHierarchyPartition(unsigned granularity, bool pruned)
 	if (data) {
 		Task task{[s=state,d=data] { d->computeAnnotations(s->annotations); },
 			      Task::Type::PARTITION_HIERARCHY, {state->hierarchy.name, data->config().name}};
+		task.provides = {data->resource(Dataset::Touch::ANNOTATIONS)};
 		JobRegistry::run(task, state->jobMonitors);
 	}
 }
@@ -22,6 +22,9 @@ SpawnDialog::SpawnDialog(Dataset::Ptr data, std::shared_ptr<WindowState> state,
 	setModal(true);
 	setSizeGripEnabled(true);
 	normalizeToggle->setChecked(data->config().normalized);
+	precisionSelect->setCurrentIndex((int)data->config().precision);
+	connect(precisionSelect, qOverload<int>(&QComboBox::currentIndexChanged),
+	        this, &SpawnDialog::updateValidity);
 	if (d->hasScores()) {
 		scoreSpinBox->setMaximum(d->scoreRange.max);
 		connect(scoreSpinBox, qOverload<double>(&QDoubleSpinBox::valueChanged), [this] {
@@ -65,6 +68,7 @@ void SpawnDialog::submit()
 	    conf.name = nameEdit->placeholderText();
 	conf.parent = source_id;
 	conf.normalized = normalizeToggle->isChecked();
+	conf.precision = (Features::Precision)precisionSelect->currentIndex();
 
 	for (unsigned i = 0; i < selected.size(); ++i)
 		if (selected[i])
@@ -103,7 +107,8 @@ void SpawnDialog::updateValidity()
 
 	auto sum = std::accumulate(selected.begin(), selected.end(), unsigned(0));
 	// Ensure that there is any real change in the data
-	valid = valid && sum > 1 && (sum < selected.size() || scoreEffect);
+	bool precisionChange = precisionSelect->currentIndex() != (int)data->config().precision;
+	valid = valid && sum > 1 && (sum < selected.size() || scoreEffect || precisionChange);
 	okButton->setEnabled(valid);
 }
 
@@ -116,5 +121,5 @@ void SpawnDialog::updateScoreEffect()
 	scoreEffect = features::cutoff_effect(d->scores, scoreSpinBox->value());
 
 	QString format{"<small>%1 / %2 proteins affected</small>"};
-	scoreNote->setText(format.arg(scoreEffect).arg(d->scores.size()));
+	scoreNote->setText(format.arg(scoreEffect).arg(d->scores.rows));
 }